@@ -0,0 +1,149 @@
+/**
+ * @file acquisition.h
+ * @brief Block based ADC acquisition. The ADC results are written by the DMA into a
+ * circular buffer split in two halves, and every time one half is filled it is handed
+ * to the electrical analyzer as a whole block.
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Number of ranks converted in every regular scan and their position inside the scan.
+// Voltage and current come first, so the scans of the injected layout, which only hold
+// these two, keep the same positions
+#define ACQUISITION_NUM_CHANNELS      4
+#define ACQUISITION_NUM_FAST_CHANNELS 2
+#define ACQUISITION_RANK_VOLTAGE      0
+#define ACQUISITION_RANK_CURRENT      1
+#define ACQUISITION_RANK_LUX          2
+#define ACQUISITION_RANK_TEMPERATURE  3
+
+// Number of scans in each half of the DMA buffer. The ADC interrupt rate is divided by
+// this value when compared with one interrupt per scan
+#define ACQUISITION_BLOCK_SCANS 128
+
+// Limits of the sample rate used when the scans are triggered by the timer. The maximum
+// leaves room for the conversion time of a whole scan
+#define ACQUISITION_MIN_SAMPLE_RATE_HZ     1000
+#define ACQUISITION_MAX_SAMPLE_RATE_HZ     50000
+#define ACQUISITION_DEFAULT_SAMPLE_RATE_HZ 7680
+
+// With the injected layout each scan has half of the conversions, so the rate doubles.
+// The scan delayed by the injected conversion takes two conversion times, 4.3 us, which
+// still fits in the period
+#define ACQUISITION_MAX_INJECTED_SAMPLE_RATE_HZ 100000
+
+// In free running mode the scans are back to back, 4 conversions of 26 cycles of the
+// 12 MHz ADC clock. It is the highest rate of all the modes, so the sums of the
+// analyzers are sized for it
+#define ACQUISITION_HIGHEST_SAMPLE_RATE_HZ 115385
+
+enum acquisition_mode {
+    // ADC converts in continuous mode, the sample rate is given by the conversion time
+    acquisition_free_running,
+    // Every scan is started by the TIM3 TRGO event, at a fixed and configurable rate
+    acquisition_timer_triggered,
+    // Same as timer triggered, but ADC1 and ADC2 convert in regular simultaneous mode so
+    // voltage and current are sampled at the same instant
+    acquisition_simultaneous,
+    // Only voltage and current in the regular scans, converted simultaneously by ADC1
+    // and ADC2. Lux and temperature are converted as injected conversions, one of each
+    // per block, started by software when the previous block is completed
+    acquisition_injected,
+    acquisition_mode_size
+};
+
+/**
+ * @brief Calibrates the ADC and starts the circular DMA transfer into the block buffer
+ *
+ */
+void acquisition_init(void);
+
+/**
+ * @brief Gets the last complete scan written by the DMA. Used by the instant readings,
+ * which do not need to wait for a whole block to be completed
+ *
+ * @return const uint16_t* Pointer to the raw ADC values of the scan
+ */
+const uint16_t* acquisition_get_latest_scan(void);
+
+/**
+ * @brief Gets a complete scan written by the DMA some scans before the latest one
+ *
+ * @param age how many scans before the latest one, limited to the buffer size
+ * @return const uint16_t* Pointer to the raw ADC values of the scan
+ */
+const uint16_t* acquisition_get_previous_scan(uint32_t age);
+
+/**
+ * @brief Gets how many values each scan of the blocks holds, which depends on the mode
+ *
+ * @return uint32_t ACQUISITION_NUM_CHANNELS, or ACQUISITION_NUM_FAST_CHANNELS when the
+ * slow channels are injected conversions
+ */
+uint32_t acquisition_get_scan_size(void);
+
+/**
+ * @brief Applies the mode and sample rate changes requested by the commands. Called from
+ * the main loop
+ *
+ */
+void acquisition_handler(void);
+
+/**
+ * @brief Stops the acquisition around work which would make the DMA interrupt miss
+ * blocks. Called from the main loop
+ *
+ */
+void acquisition_pause(void);
+
+/**
+ * @brief Starts the acquisition stopped by acquisition_pause. The window in progress of
+ * the electrical analyzer is discarded, as it is missing the scans of the pause
+ *
+ */
+void acquisition_resume(void);
+
+/**
+ * @brief Updates the mode in which the ADC scans are started. The acquisition is
+ * restarted by the main loop
+ *
+ * @param mode new mode, one of acquisition_mode
+ */
+void acquisition_update_mode(int32_t mode);
+
+/**
+ * @brief Updates the rate of the timer which triggers the ADC scans. The value is
+ * checked and the acquisition restarted by the main loop, after any mode change
+ * requested before it
+ *
+ * @param value new sample rate in Hz, limited by ACQUISITION_MIN_SAMPLE_RATE_HZ and
+ * ACQUISITION_MAX_SAMPLE_RATE_HZ
+ */
+void acquisition_update_sample_rate(int32_t value);
+
+/**
+ * @brief Gets the rate in which the scans are being acquired
+ *
+ * @return uint32_t sample rate in Hz
+ */
+uint32_t acquisition_get_sample_rate(void);
+
+/**
+ * @brief Gets the rate in which the scans are being acquired without rounding it, to be
+ * used as time reference by the measurements that count samples
+ *
+ * @return uint64_t sample rate in uHz
+ */
+uint64_t acquisition_get_sample_rate_uHz(void);
+
+/**
+ * @brief Gets the rate in which lux and temperature samples are delivered to the
+ * oversampler, lower than the sample rate when they are injected conversions
+ *
+ * @return uint32_t sample rate in Hz
+ */
+uint32_t acquisition_get_slow_sample_rate(void);
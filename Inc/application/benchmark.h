@@ -0,0 +1,21 @@
+/**
+ * @file benchmark.h
+ * @brief Measures in CPU cycles the cost of the processing kernels on the target and
+ * sends the results through the USB
+ *
+ */
+
+#pragma once
+
+/**
+ * @brief Requests every benchmark to be run by the main loop
+ *
+ */
+void benchmark_run(void);
+
+/**
+ * @brief Runs the requested benchmarks with the acquisition stopped and sends the cycles
+ * per call of each one. Called from the main loop
+ *
+ */
+void benchmark_handler(void);
@@ -0,0 +1,62 @@
+/**
+ * @file binary_frame.h
+ * @brief Encodes the streamed values as binary records framed with COBS. Every record is
+ * the channel, the number of values, a sequence counter, the values as little endian
+ * 32 bit integers and a CRC-16/CCITT-FALSE of all of them. After COBS the record has no
+ * zero bytes, so a zero byte ends every frame and the host can resynchronize on it.
+ * Records of other streams carry an encoded payload instead of the values, and the count
+ * is defined by the stream
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define BINARY_FRAME_MAX_VALUES  40
+#define BINARY_FRAME_HEADER_SIZE 4
+#define BINARY_FRAME_CRC_SIZE    2
+#define BINARY_FRAME_MAX_PAYLOAD_SIZE (BINARY_FRAME_MAX_VALUES * 4)
+#define BINARY_FRAME_MAX_RECORD_SIZE                                                     \
+    (BINARY_FRAME_HEADER_SIZE + BINARY_FRAME_MAX_PAYLOAD_SIZE + BINARY_FRAME_CRC_SIZE)
+// COBS adds one code byte every 254 bytes and one at the start, and the frame ends with
+// the zero delimiter
+#define BINARY_FRAME_MAX_SIZE                                                            \
+    (BINARY_FRAME_MAX_RECORD_SIZE + BINARY_FRAME_MAX_RECORD_SIZE / 254 + 2)
+
+/**
+ * @brief Encodes a record of values into a frame
+ *
+ * @param channel id of the streamed channel
+ * @param sequence counter of the record, incremented by the caller for every record
+ * @param values values of the record
+ * @param count number of values, limited by BINARY_FRAME_MAX_VALUES
+ * @param frame where the frame is written, BINARY_FRAME_MAX_SIZE bytes
+ * @return uint32_t size of the frame, including the delimiter
+ */
+uint32_t binary_frame_encode(uint8_t channel, uint16_t sequence, const int32_t* values,
+                             uint32_t count, uint8_t* frame);
+
+/**
+ * @brief Encodes a record with an already encoded payload into a frame
+ *
+ * @param channel id of the streamed channel
+ * @param count count field of the record, its meaning is defined by the channel
+ * @param sequence counter of the record, incremented by the caller for every record
+ * @param payload payload of the record
+ * @param size size of the payload, limited by BINARY_FRAME_MAX_PAYLOAD_SIZE
+ * @param frame where the frame is written, BINARY_FRAME_MAX_SIZE bytes
+ * @return uint32_t size of the frame, including the delimiter
+ */
+uint32_t binary_frame_encode_payload(uint8_t channel, uint8_t count, uint16_t sequence,
+                                     const uint8_t* payload, uint32_t size,
+                                     uint8_t* frame);
+
+/**
+ * @brief Calculates the CRC-16/CCITT-FALSE of a buffer
+ *
+ * @param data buffer
+ * @param size size of the buffer
+ * @return uint16_t crc
+ */
+uint16_t binary_frame_crc16(const uint8_t* data, uint32_t size);
@@ -0,0 +1,95 @@
+/**
+ * @file capture.h
+ * @brief Oscilloscope style capture of the raw voltage and current samples. A ring keeps
+ * the samples before the trigger, and after the trigger condition is met the ring is
+ * frozen once the post trigger samples are stored, so it can be downloaded over the USB
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+// Must be a power of two, so the ring indexes can be wrapped with a mask
+#define CAPTURE_SAMPLES       512
+#define CAPTURE_DEFAULT_PRE   128
+#define CAPTURE_DEFAULT_LEVEL 2048
+#define CAPTURE_MAX_HOLD_OFF  1000000
+
+enum capture_condition {
+    // Triggers on the first sample at or above the level
+    capture_level_above,
+    // Triggers on the first sample below the level
+    capture_level_below,
+    // Triggers when the samples cross the level upwards
+    capture_rising_edge,
+    // Triggers when the samples cross the level downwards
+    capture_falling_edge,
+    capture_condition_size
+};
+
+enum capture_channel { capture_voltage, capture_current, capture_channel_size };
+
+/**
+ * @brief Stores the samples in the ring and checks the trigger condition while the
+ * capture is armed. Called from the DMA interrupt
+ *
+ * @param block pointer to the first scan of the block
+ * @param scans number of scans in the block
+ */
+void capture_process_block(const uint16_t* block, uint32_t scans);
+
+/**
+ * @brief Notifies a frozen capture and sends its samples when a download was requested.
+ * Called from the main loop
+ *
+ */
+void capture_handler(void);
+
+/**
+ * @brief Starts filling the ring and waiting for the trigger condition
+ *
+ */
+void capture_arm(void);
+
+/**
+ * @brief Requests the download of a frozen capture. The samples are sent as binary, two
+ * little endian 16 bit raw codes per scan, voltage and current, oldest first
+ *
+ */
+void capture_download(void);
+
+/**
+ * @brief Updates the trigger condition
+ *
+ * @param value condition, one of capture_condition
+ */
+void capture_update_condition(int32_t value);
+
+/**
+ * @brief Updates the trigger level
+ *
+ * @param value level as a raw ADC code
+ */
+void capture_update_level(int32_t value);
+
+/**
+ * @brief Updates the channel compared with the trigger level
+ *
+ * @param value channel, one of capture_channel
+ */
+void capture_update_channel(int32_t value);
+
+/**
+ * @brief Updates how many of the captured samples are taken before the trigger
+ *
+ * @param value pre trigger samples, below CAPTURE_SAMPLES
+ */
+void capture_update_pre_trigger(int32_t value);
+
+/**
+ * @brief Updates the hold off, the samples after arming in which the trigger is ignored
+ *
+ * @param value hold off samples, limited by CAPTURE_MAX_HOLD_OFF
+ */
+void capture_update_hold_off(int32_t value);
@@ -0,0 +1,81 @@
+/**
+ * @file delta_codec.h
+ * @brief Compresses the raw voltage and current codes of consecutive scans. Every sample
+ * is replaced by its difference to the previous sample of the same channel, the
+ * difference is zig-zag mapped so small negative values stay small, and written as a
+ * LEB128 varint, 7 bits per byte with the high bit set while more bytes follow. A 50 or
+ * 60 Hz sine changes little from scan to scan, so most samples take a single byte.
+ * Keyframes start again from zero, so a decoder can join the stream on any of them. It
+ * does not depend on the HAL, so the same file decodes the stream on the host
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Interleaved channels of every scan, voltage and current
+#define DELTA_CODEC_CHANNELS 2
+// A difference of 12 bit codes is zig-zag mapped below 2^14, two bytes of 7 bits
+#define DELTA_CODEC_MAX_BYTES_PER_VALUE 2
+// Worst case size of the encoded scans
+#define DELTA_CODEC_MAX_SIZE(scans)                                                      \
+    ((scans) * DELTA_CODEC_CHANNELS * DELTA_CODEC_MAX_BYTES_PER_VALUE)
+// Bytes of a LEB128 encoded 32 bit value
+#define DELTA_CODEC_MAX_VARINT_SIZE 5
+
+struct delta_codec {
+    // Last sample of every channel, the reference of the next difference
+    uint16_t previous[DELTA_CODEC_CHANNELS];
+};
+
+/**
+ * @brief Encodes scans as differences to the previous ones
+ *
+ * @param codec state of the stream, the same one for all the scans of a stream
+ * @param samples interleaved 12 bit samples, voltage and current of every scan
+ * @param scans number of scans
+ * @param is_keyframe true to encode the first scan from zero instead of from the last
+ * scan encoded, so it can be decoded alone
+ * @param output where the scans are written, DELTA_CODEC_MAX_SIZE(scans) bytes
+ * @return uint32_t number of bytes written
+ */
+uint32_t delta_codec_encode(struct delta_codec* codec, const uint16_t* samples,
+                            uint32_t scans, bool is_keyframe, uint8_t* output);
+
+/**
+ * @brief Decodes scans encoded by delta_codec_encode
+ *
+ * @param codec state of the stream, only used by delta frames when the previous frames
+ * were decoded
+ * @param input encoded scans
+ * @param size size of the input
+ * @param scans number of scans to be decoded
+ * @param is_keyframe true when the scans were encoded as a keyframe
+ * @param samples where the interleaved samples are written
+ * @return uint32_t number of bytes read, zero when the input is truncated or malformed
+ */
+uint32_t delta_codec_decode(struct delta_codec* codec, const uint8_t* input,
+                            uint32_t size, uint32_t scans, bool is_keyframe,
+                            uint16_t* samples);
+
+/**
+ * @brief Writes an unsigned value as a LEB128 varint
+ *
+ * @param output where the value is written, DELTA_CODEC_MAX_VARINT_SIZE bytes at most
+ * @param value value to be written
+ * @return uint32_t number of bytes written
+ */
+uint32_t delta_codec_put_varint(uint8_t* output, uint32_t value);
+
+/**
+ * @brief Reads an unsigned LEB128 varint
+ *
+ * @param input encoded value
+ * @param size bytes available in the input
+ * @param value where the value is written
+ * @return uint32_t number of bytes read, zero when the input is truncated or longer than
+ * a 32 bit value
+ */
+uint32_t delta_codec_get_varint(const uint8_t* input, uint32_t size, uint32_t* value);
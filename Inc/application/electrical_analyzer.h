@@ -3,15 +3,40 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+// Waveform statistics of one channel, with the mean of the window removed
+struct waveform_statistics {
+    int32_t min;
+    int32_t max;
+    int32_t peak_to_peak;
+    // Ratio between the peak and the rms, multiplied by 1000
+    int32_t crest_factor;
+    // Highest peak since the last clear, kept across windows
+    int32_t peak_hold;
+};
+
 void electrical_analyzer_init(void);
 
 void electrical_analyzer_handler(void);
 
-void set_is_rms_acquisition_activated(bool status);
+void electrical_analyzer_process_block(const uint16_t* block, uint32_t scans);
+
+void electrical_analyzer_reset(void);
+
+void electrical_analyzer_update_window_cycles(int32_t value);
+
+void electrical_analyzer_update_phase_delay(int32_t value);
+
+void electrical_analyzer_show_energy(void);
 
-float get_lux(void);
+void electrical_analyzer_reset_energy(void);
 
-float get_temperature(void);
+void electrical_analyzer_clear_peak_hold(void);
+
+uint32_t get_window_overruns(void);
+
+int32_t get_lux(void);
+
+int32_t get_temperature(void);
 
 int32_t get_instant_voltage(void);
 
@@ -19,8 +44,28 @@ int32_t get_instant_current(void);
 
 int32_t get_instant_power(void);
 
+int32_t get_voltage_offset(void);
+
+int32_t get_current_offset(void);
+
+const struct waveform_statistics* get_voltage_statistics(void);
+
+const struct waveform_statistics* get_current_statistics(void);
+
 int32_t get_voltage_rms(void);
 
 int32_t get_current_rms(void);
 
-int32_t get_power_rms(void);
+int32_t get_active_power(void);
+
+int32_t get_apparent_power(void);
+
+int32_t get_reactive_power(void);
+
+int32_t get_power_factor(void);
+
+int32_t get_voltage_harmonic(uint8_t harmonic);
+
+int32_t get_current_harmonic(uint8_t harmonic);
+
+int32_t get_spectrum_magnitude(uint32_t bin);
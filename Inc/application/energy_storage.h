@@ -0,0 +1,65 @@
+/**
+ * @file energy_storage.h
+ * @brief Keeps the energy counters and the calibration in the flash pages reserved by
+ * the linker script, so they survive resets. Every checkpoint is appended as a new
+ * record. The page after the one being filled is erased in advance, so a save never
+ * waits for an erase
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct energy_counters {
+    int64_t active_uJ;
+    int64_t reactive_uJ;
+    int64_t apparent_uJ;
+};
+
+struct calibration {
+    // Delay applied to the current to compensate the phase lag of the transformer
+    int32_t phase_delay_ns;
+};
+
+/**
+ * @brief Reads the most recent valid record from the flash
+ *
+ * @param counters where the stored counters are written, cleared when there is no record
+ * @param calibration where the stored calibration is written, untouched when there is
+ * no record so the defaults are kept
+ * @return true if a valid record was found
+ */
+bool energy_storage_load(struct energy_counters* counters,
+                         struct calibration* calibration);
+
+/**
+ * @brief Checks if the next record can be written right away. It cannot while the page
+ * it goes to is waiting to be erased by energy_storage_erase_spare
+ *
+ * @return true if energy_storage_save can write the record
+ */
+bool energy_storage_is_ready(void);
+
+/**
+ * @brief Appends a record with the counters and the calibration to the flash. Nothing is
+ * erased here. Programming the record stalls the flash fetches for about 2 ms, so the
+ * acquisition must be paused around it
+ *
+ * @param counters counters to be stored
+ * @param calibration calibration to be stored
+ * @return true if the record was written and read back correctly, false as well when
+ * energy_storage_is_ready is false
+ */
+bool energy_storage_save(const struct energy_counters* counters,
+                         const struct calibration* calibration);
+
+/**
+ * @brief Erases the spare page if it is not erased yet. A page erase takes 20 to 40 ms,
+ * and every fetch from the flash waits for it, interrupts included, so the acquisition
+ * must be paused around it. It only has work once every 16 saves
+ *
+ * @return true if the spare page is erased
+ */
+bool energy_storage_erase_spare(void);
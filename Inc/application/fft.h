@@ -0,0 +1,48 @@
+/**
+ * @file fft.h
+ * @brief In place radix-4 fast Fourier transform in Q15, with the twiddle factors in a
+ * table in flash
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+// Size of the twiddle table, the largest transform supported
+#define FFT_MAX_POINTS 512
+
+/**
+ * @brief Gets the sine of an angle from the twiddle table
+ *
+ * @param index angle in units of 2 * pi / FFT_MAX_POINTS, taken modulo FFT_MAX_POINTS
+ * @return int16_t sine in Q15
+ */
+int16_t fft_sin_q15(uint32_t index);
+
+/**
+ * @brief Gets the cosine of an angle from the twiddle table
+ *
+ * @param index angle in units of 2 * pi / FFT_MAX_POINTS, taken modulo FFT_MAX_POINTS
+ * @return int16_t cosine in Q15
+ */
+int16_t fft_cos_q15(uint32_t index);
+
+/**
+ * @brief Computes the forward transform in place. Every stage is scaled, so the result
+ * is the DFT divided by the number of points and cannot overflow. The output is left in
+ * digit reversed order, see fft_q15_bin_position
+ *
+ * @param data interleaved real and imaginary parts, 2 * points values
+ * @param points number of points, a power of two from 4 up to FFT_MAX_POINTS
+ */
+void fft_q15(int16_t* data, uint32_t points);
+
+/**
+ * @brief Gets where a frequency bin is stored after fft_q15
+ *
+ * @param bin frequency bin, from 0 to points - 1
+ * @param points number of points of the transform
+ * @return uint32_t index of the complex value of the bin in the data
+ */
+uint32_t fft_q15_bin_position(uint32_t bin, uint32_t points);
@@ -0,0 +1,37 @@
+/**
+ * @file fixed_math.h
+ * @brief Integer math kernels used by the measurement paths. The target has no FPU, so
+ * these replace the libm calls that would go through software double precision
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+// Fixed point format with 30 fractional bits, able to hold values in the range [-2, 2)
+#define FIXED_MATH_Q30_ONE (1L << 30)
+
+/**
+ * @brief Integer square root of a 32 bit value
+ *
+ * @param value radicand
+ * @return uint32_t floor(sqrt(value))
+ */
+uint32_t fixed_math_isqrt32(uint32_t value);
+
+/**
+ * @brief Integer square root of a 64 bit value
+ *
+ * @param value radicand
+ * @return uint32_t floor(sqrt(value))
+ */
+uint32_t fixed_math_isqrt64(uint64_t value);
+
+/**
+ * @brief Cosine of a small angle in fixed point
+ *
+ * @param angle angle in radians in Q30, valid in the range [-1, 1]
+ * @return int32_t cosine in Q30
+ */
+int32_t fixed_math_cos_q30(int32_t angle);
@@ -0,0 +1,53 @@
+/**
+ * @file formatter.h
+ * @brief Writes text and integers straight into a transmission buffer, without the
+ * format parsing of sprintf. Fractional values are kept as scaled integers and printed
+ * as fixed point decimals. Nothing is terminated, every function returns the number of
+ * characters written so calls can be chained on a running index
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+// Longer fractions do not fit in the digits of a 32 bit value
+#define FORMATTER_MAX_DECIMALS 9
+
+/**
+ * @brief Writes a text
+ *
+ * @param buffer where the text is written
+ * @param text null terminated text, the terminator is not written
+ * @return int32_t number of characters written
+ */
+int32_t formatter_text(char* buffer, const char* text);
+
+/**
+ * @brief Writes an unsigned integer in decimal
+ *
+ * @param buffer where the number is written, 10 characters at most
+ * @param value number to be written
+ * @return int32_t number of characters written
+ */
+int32_t formatter_uint(char* buffer, uint32_t value);
+
+/**
+ * @brief Writes a signed integer in decimal
+ *
+ * @param buffer where the number is written, 11 characters at most
+ * @param value number to be written
+ * @return int32_t number of characters written
+ */
+int32_t formatter_int(char* buffer, int32_t value);
+
+/**
+ * @brief Writes a fixed point decimal, a value scaled by a power of ten, with all of its
+ * decimals. For instance 1234 with 2 decimals is written as 12.34 and -5 as -0.05
+ *
+ * @param buffer where the number is written, 12 characters at most
+ * @param value number scaled by 10 to the power of decimals
+ * @param decimals number of decimals, limited by FORMATTER_MAX_DECIMALS
+ * @return int32_t number of characters written
+ */
+int32_t formatter_fixed(char* buffer, int32_t value, uint32_t decimals);
@@ -0,0 +1,44 @@
+/**
+ * @file frequency_analyzer.h
+ * @brief Measures the mains frequency from the time between the zero crossings of the
+ * voltage, using the sample index interpolated between samples as time reference
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define FREQUENCY_ANALYZER_MIN_CYCLES     1
+#define FREQUENCY_ANALYZER_MAX_CYCLES     600
+#define FREQUENCY_ANALYZER_DEFAULT_CYCLES 10
+
+/**
+ * @brief Adds the time of a rising zero crossing. Every time the configured number of
+ * cycles is completed a new frequency is published. Called from the DMA interrupt
+ *
+ * @param timestamp_q16 time of the crossing, counted in samples, in Q16
+ */
+void frequency_analyzer_add_crossing(uint64_t timestamp_q16);
+
+/**
+ * @brief Discards the crossings of the average in progress, for instance when the
+ * voltage is lost and the next crossing would not be one cycle later
+ *
+ */
+void frequency_analyzer_reset(void);
+
+/**
+ * @brief Updates how many cycles are averaged in every measurement
+ *
+ * @param value number of cycles, limited by FREQUENCY_ANALYZER_MIN_CYCLES and
+ * FREQUENCY_ANALYZER_MAX_CYCLES
+ */
+void frequency_analyzer_update_cycles(int32_t value);
+
+/**
+ * @brief Gets the frequency measured over the last completed cycles
+ *
+ * @return uint32_t frequency in uHz, 0 while no measurement was completed
+ */
+uint32_t frequency_analyzer_get_frequency(void);
@@ -0,0 +1,71 @@
+/**
+ * @file harmonic_analyzer.h
+ * @brief Streaming Goertzel filter bank that measures the mains harmonics of voltage and
+ * current over every RMS window, one sample at a time
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define HARMONIC_ANALYZER_MAX_HARMONIC 15
+
+/**
+ * @brief Starts a new window. Computes the filter coefficients for the selected
+ * harmonics and clears the filter states. Called from the DMA interrupt
+ *
+ * @param samples_per_cycle_q16 length of one mains cycle in samples, in Q16
+ * @param cycles expected number of cycles in the window, used to avoid overflows
+ */
+void harmonic_analyzer_start_window(uint32_t samples_per_cycle_q16, uint32_t cycles);
+
+/**
+ * @brief Runs one sample through the filters of every selected harmonic. Called from the
+ * DMA interrupt
+ *
+ * @param voltage voltage sample in ADC codes, with the offset removed
+ * @param current current sample in ADC codes, with the offset removed
+ */
+void harmonic_analyzer_update(int32_t voltage, int32_t current);
+
+/**
+ * @brief Finishes the window and publishes the magnitude of every selected harmonic.
+ * Called from the DMA interrupt
+ *
+ * @param samples number of samples in the window
+ */
+void harmonic_analyzer_finish_window(uint32_t samples);
+
+/**
+ * @brief Updates which harmonics are measured and streamed
+ *
+ * @param value bit mask, bit 0 for the fundamental up to bit 14 for the 15th harmonic
+ */
+void harmonic_analyzer_update_selection(int32_t value);
+
+/**
+ * @brief Gets which harmonics are measured
+ *
+ * @return uint16_t bit mask, bit 0 for the fundamental up to bit 14 for the 15th harmonic
+ */
+uint16_t harmonic_analyzer_get_selection(void);
+
+/**
+ * @brief Gets the rms value of a voltage harmonic in the last window
+ *
+ * @param harmonic harmonic order, 1 for the fundamental
+ * @return uint32_t rms value in ADC codes, in Q8, zero when the harmonic is not
+ * measured
+ */
+uint32_t harmonic_analyzer_get_voltage(uint8_t harmonic);
+
+/**
+ * @brief Gets the rms value of a current harmonic in the last window
+ *
+ * @param harmonic harmonic order, 1 for the fundamental
+ * @return uint32_t rms value in ADC codes, in Q8, zero when the harmonic is not
+ * measured
+ */
+uint32_t harmonic_analyzer_get_current(uint8_t harmonic);
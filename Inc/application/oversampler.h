@@ -0,0 +1,53 @@
+/**
+ * @file oversampler.h
+ * @brief Oversampling and decimation of the slow channels, lux and temperature. Every
+ * output averages all the samples acquired in its period, which adds resolution beyond
+ * the 12 bits of the ADC
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+// Every extra bit needs four times more samples, so 4 extra bits need 256 samples
+#define OVERSAMPLER_EXTRA_BITS          4
+#define OVERSAMPLER_MIN_OUTPUT_RATE_HZ  1
+#define OVERSAMPLER_MAX_OUTPUT_RATE_HZ  100
+#define OVERSAMPLER_DEFAULT_OUTPUT_RATE 10
+
+enum oversampler_channel { oversampler_lux, oversampler_temperature, oversampler_size };
+
+/**
+ * @brief Accumulates samples of the slow channels and publishes a new output when the
+ * output period is completed. Called from the DMA interrupt
+ *
+ * @param samples pointer to the first lux sample, followed by the temperature sample
+ * @param count number of samples of each channel
+ * @param stride distance between consecutive samples of the same channel
+ */
+void oversampler_process_block(const uint16_t* samples, uint32_t count, uint32_t stride);
+
+/**
+ * @brief Updates the rate of the outputs. Lower rates average more samples
+ *
+ * @param value output rate in Hz, limited by OVERSAMPLER_MIN_OUTPUT_RATE_HZ,
+ * OVERSAMPLER_MAX_OUTPUT_RATE_HZ and the rate of the slow samples
+ */
+void oversampler_update_output_rate(int32_t value);
+
+/**
+ * @brief Gets the last output of a channel
+ *
+ * @param channel one of oversampler_channel
+ * @return uint16_t ADC code with OVERSAMPLER_EXTRA_BITS fractional bits
+ */
+uint16_t oversampler_get(enum oversampler_channel channel);
+
+/**
+ * @brief Gets how many bits the last outputs effectively have, which depends on how many
+ * samples were averaged
+ *
+ * @return uint32_t effective number of bits, from 12 to 12 + OVERSAMPLER_EXTRA_BITS
+ */
+uint32_t oversampler_get_effective_bits(void);
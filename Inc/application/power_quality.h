@@ -0,0 +1,84 @@
+/**
+ * @file power_quality.h
+ * @brief Detects dips, swells and interruptions of the voltage with the rms of one mains
+ * cycle refreshed every half cycle, as IEC 61000-4-30. The events are logged in a ring
+ * that is drained by the host
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define POWER_QUALITY_NOMINAL_mV 127000
+// Dip and interruption thresholds of IEC 61000-4-30. The swell threshold is below its
+// 110 %, as the front end saturates at about 138 V rms
+#define POWER_QUALITY_DEFAULT_DIP_mV          (POWER_QUALITY_NOMINAL_mV * 90 / 100)
+#define POWER_QUALITY_DEFAULT_SWELL_mV        (POWER_QUALITY_NOMINAL_mV * 108 / 100)
+#define POWER_QUALITY_DEFAULT_INTERRUPTION_mV (POWER_QUALITY_NOMINAL_mV * 10 / 100)
+#define POWER_QUALITY_HYSTERESIS_mV           (POWER_QUALITY_NOMINAL_mV * 2 / 100)
+#define POWER_QUALITY_MAX_THRESHOLD_mV        200000
+
+/**
+ * @brief Adds a sample to the half cycle in progress. Called from the DMA interrupt
+ *
+ * @param voltage voltage sample in ADC codes, with the offset removed
+ */
+void power_quality_update(int32_t voltage);
+
+/**
+ * @brief Closes the half cycle in progress at a zero crossing of the voltage, refreshes
+ * the rms of the last cycle and checks it against the thresholds. Called from the DMA
+ * interrupt
+ *
+ */
+void power_quality_finish_half_cycle(void);
+
+/**
+ * @brief Discards the half cycles and the event in progress, for instance when the
+ * samples stop being processed
+ *
+ */
+void power_quality_reset(void);
+
+/**
+ * @brief Sends the logged events when requested. Called from the main loop
+ *
+ */
+void power_quality_handler(void);
+
+/**
+ * @brief Requests the logged events to be sent, oldest first. Each event is removed from
+ * the ring once sent
+ *
+ */
+void power_quality_drain_events(void);
+
+/**
+ * @brief Updates the dip threshold
+ *
+ * @param value threshold in mV rms, between the interruption and the swell thresholds
+ */
+void power_quality_update_dip(int32_t value);
+
+/**
+ * @brief Updates the swell threshold
+ *
+ * @param value threshold in mV rms, above the dip threshold and limited by
+ * POWER_QUALITY_MAX_THRESHOLD_mV
+ */
+void power_quality_update_swell(int32_t value);
+
+/**
+ * @brief Updates the interruption threshold
+ *
+ * @param value threshold in mV rms, below the dip threshold
+ */
+void power_quality_update_interruption(int32_t value);
+
+/**
+ * @brief Gets the rms of the last mains cycle, refreshed every half cycle
+ *
+ * @return int32_t voltage in mV RMS
+ */
+int32_t power_quality_get_rms(void);
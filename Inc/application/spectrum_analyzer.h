@@ -0,0 +1,87 @@
+/**
+ * @file spectrum_analyzer.h
+ * @brief Captures a block of the voltage or current samples from the DMA stream and
+ * computes its magnitude spectrum with the Q15 FFT
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SPECTRUM_ANALYZER_MIN_POINTS     256
+#define SPECTRUM_ANALYZER_MAX_POINTS     512
+#define SPECTRUM_ANALYZER_DEFAULT_POINTS 256
+
+enum spectrum_analyzer_channel {
+    spectrum_analyzer_voltage,
+    spectrum_analyzer_current,
+    spectrum_analyzer_channel_size
+};
+
+/**
+ * @brief Copies the samples of the selected channel while a capture is in progress.
+ * Called from the DMA interrupt
+ *
+ * @param block pointer to the first scan of the block
+ * @param scans number of scans in the block
+ */
+void spectrum_analyzer_process_block(const uint16_t* block, uint32_t scans);
+
+/**
+ * @brief Computes the spectrum of a finished capture and starts the next one. Called
+ * from the main loop, as the FFT takes too long to run in the interrupt
+ *
+ */
+void spectrum_analyzer_handler(void);
+
+/**
+ * @brief Allows other files to start or stop the captures
+ *
+ * @param value true to capture continuously
+ */
+void spectrum_analyzer_set_is_activated(bool value);
+
+/**
+ * @brief Updates the number of points of the transform and restarts the capture
+ *
+ * @param value number of points, 256 or 512
+ */
+void spectrum_analyzer_update_points(int32_t value);
+
+/**
+ * @brief Updates which channel is captured and restarts the capture
+ *
+ * @param value channel, one of spectrum_analyzer_channel
+ */
+void spectrum_analyzer_update_channel(int32_t value);
+
+/**
+ * @brief Gets the number of bins of the last spectrum, half of its number of points
+ *
+ * @return uint32_t number of bins, 0 while no spectrum was computed
+ */
+uint32_t spectrum_analyzer_get_bins(void);
+
+/**
+ * @brief Gets the width of each bin of the last spectrum
+ *
+ * @return uint32_t bin width in mHz
+ */
+uint32_t spectrum_analyzer_get_bin_width(void);
+
+/**
+ * @brief Gets which channel the last spectrum belongs to
+ *
+ * @return enum spectrum_analyzer_channel channel of the last spectrum
+ */
+enum spectrum_analyzer_channel spectrum_analyzer_get_channel(void);
+
+/**
+ * @brief Gets the magnitude of one bin of the last spectrum
+ *
+ * @param bin frequency bin, from 0 to spectrum_analyzer_get_bins() - 1
+ * @return uint32_t rms value in ADC codes, in Q8
+ */
+uint32_t spectrum_analyzer_get_magnitude(uint32_t bin);
@@ -58,3 +58,18 @@ bool timer_wait_us(uint32_t timer_start, uint32_t delay);
  * powered up
  */
 uint32_t timer_update_us(void);
+
+/**
+ * @brief Starts the core cycle counter of the DWT unit, used to measure the execution
+ * time of code in CPU cycles
+ *
+ */
+void timer_cycles_init(void);
+
+/**
+ * @brief Gets the current value of the core cycle counter
+ *
+ * @return uint32_t CPU cycles that have passed since timer_cycles_init was called. It
+ * overflows after approximately 59 seconds
+ */
+uint32_t timer_update_cycles(void);
@@ -0,0 +1,91 @@
+/**
+ * @file unit_conversion.h
+ * @brief Conversion of the ADC codes to engineering units. The calibration of the analog
+ * front end is kept here, and the per sample conversions of voltage and current are
+ * tables built by the compiler, so each conversion is a single load from the flash
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+// Number of codes of the 12 bit ADC, the size of the conversion tables
+#define UNIT_CONVERSION_ADC_CODES 4096
+
+#define ADC_BIT_TO_mV(x) ((3300 * (x)) / 4095)
+#define ADC_mV_TO_BIT(x) (((x) * 4095) / 3300)
+
+#define SQUARE_ROOT_x1000 1414
+
+// Defines about voltage acquisition
+#define VOLTAGE_REDUCED_MAX_mV 3160
+#define VOLTAGE_REDUCED_MIN_mV 200
+#define VOLTAGE_REAL_MAX_mV    (127 * SQUARE_ROOT_x1000)
+
+#define VOLTAGE_REDUCED_OFFSET_mV ((VOLTAGE_REDUCED_MIN_mV + VOLTAGE_REDUCED_MAX_mV) / 2)
+#define VOLTAGE_GAIN                                                                     \
+    (VOLTAGE_REAL_MAX_mV / (VOLTAGE_REDUCED_MAX_mV - VOLTAGE_REDUCED_OFFSET_mV))
+
+#define VOLTAGE_REDUCED_OFFSET_BIT   ADC_mV_TO_BIT(VOLTAGE_REDUCED_OFFSET_mV)
+#define VOLTAGE_BIT_TO_REDUCED_mV(x) (ADC_BIT_TO_mV(x) - VOLTAGE_REDUCED_OFFSET_mV)
+#define VOLTAGE_BIT_TO_REAL_V(x)     (VOLTAGE_GAIN * VOLTAGE_BIT_TO_REDUCED_mV(x) / 1000)
+#define VOLTAGE_BIT_Q8_TO_REAL_mV(x)                                                     \
+    (((uint64_t)(x) * 3300 * VOLTAGE_GAIN) / (4095 * 256))
+#define VOLTAGE_REAL_mV_TO_BIT_Q8(x)                                                     \
+    (((uint64_t)(x) * 4095 * 256) / (3300 * VOLTAGE_GAIN))
+
+// Defines about current acquisition
+#define CURRENT_REDUCED_MAX_mV   2760
+#define CURRENT_REDUCED_MIN_mV   80
+#define CURRENT_REAL_MAX_uV      (200 * 1000)
+#define CURRENT_REAL_SHUNT_VALUE (3)
+
+#define CURRENT_REDUCED_OFFSET_mV ((CURRENT_REDUCED_MIN_mV + CURRENT_REDUCED_MAX_mV) / 2)
+#define CURRENT_GAIN                                                                     \
+    (CURRENT_REAL_MAX_uV / (CURRENT_REDUCED_MAX_mV - CURRENT_REDUCED_OFFSET_mV))
+
+#define CURRENT_REDUCED_OFFSET_BIT   ADC_mV_TO_BIT(CURRENT_REDUCED_OFFSET_mV)
+#define CURRENT_BIT_TO_REDUCED_mV(x) (ADC_BIT_TO_mV(x) - CURRENT_REDUCED_OFFSET_mV)
+#define CURRENT_BIT_TO_REAL_mA(x)                                                        \
+    ((CURRENT_GAIN * CURRENT_BIT_TO_REDUCED_mV(x)) / (CURRENT_REAL_SHUNT_VALUE * 1000))
+#define CURRENT_BIT_Q8_TO_REAL_uA(x)                                                     \
+    (((uint64_t)(x) * 3300 * CURRENT_GAIN) / (4095 * 256 * CURRENT_REAL_SHUNT_VALUE))
+
+// Converts the product of a voltage code and a current code, in Q8, to power. The codes
+// are in mV and uA after scaling, so the product is in nW. Part of the divisor is
+// applied to the constant, so the product fits in 64 bits for any pair of codes
+#define POWER_PER_BIT2_nW_x4095                                                          \
+    (3300LL * 3300 * VOLTAGE_GAIN * CURRENT_GAIN / (4095 * CURRENT_REAL_SHUNT_VALUE))
+#define POWER_BIT2_Q8_TO_REAL_mW(x)                                                      \
+    (((int64_t)(x) * POWER_PER_BIT2_nW_x4095) / ((int64_t)4095 * 256 * 1000000))
+
+// Linear fits of the sensors, as a function of the 12 bit code
+#define TEMPERATURE_SLOPE     0.025062823967831f
+#define TEMPERATURE_INTERCEPT -25.505305176557748f
+#define LUX_SLOPE             0.911390660003446f
+#define LUX_INTERCEPT         -425.5767706358779f
+#define LUX_CODE_OFFSET       150
+#define LUX_MIN_CODE          470
+
+// Voltage in V of every ADC code, the same values given by VOLTAGE_BIT_TO_REAL_V
+extern const int16_t unit_conversion_voltage_V[UNIT_CONVERSION_ADC_CODES];
+
+// Current in mA of every ADC code, the same values given by CURRENT_BIT_TO_REAL_mA
+extern const int8_t unit_conversion_current_mA[UNIT_CONVERSION_ADC_CODES];
+
+/**
+ * @brief Converts an oversampled lux code to lux, in integer math
+ *
+ * @param code lux code with OVERSAMPLER_EXTRA_BITS of fraction
+ * @return int32_t value in tenths of lx
+ */
+int32_t unit_conversion_lux(uint16_t code);
+
+/**
+ * @brief Converts an oversampled temperature code to temperature, in integer math
+ *
+ * @param code temperature code with OVERSAMPLER_EXTRA_BITS of fraction
+ * @return int32_t value in hundredths of celsius
+ */
+int32_t unit_conversion_temperature(uint16_t code);
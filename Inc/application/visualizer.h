@@ -4,4 +4,7 @@
 
 void visualizer_update_frequency(int32_t requestedFrequency);
 void visualizer_update_channels(uint8_t channel);
+void visualizer_update_format(int32_t value);
+void visualizer_subscribe(int32_t channel, int32_t frequency);
+void visualizer_unsubscribe(int32_t channel);
 void visualizer_handler(void);
@@ -0,0 +1,42 @@
+/**
+ * @file waveform_stream.h
+ * @brief Continuous stream of the raw voltage and current samples, compressed by the
+ * delta codec and sent as binary frames. Keyframes carry the number of the first scan
+ * and are sent periodically and after any lost scans, so the host can resynchronize
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+// Scans of every frame, the ring holds whole acquisition blocks split in frames
+#define WAVEFORM_STREAM_FRAME_SCANS 32
+// Channel ids of the binary frames, above the ids of the visualizer channels
+#define WAVEFORM_STREAM_KEYFRAME_CHANNEL 0x80
+#define WAVEFORM_STREAM_DELTA_CHANNEL    0x81
+// Frames between two keyframes when nothing is lost
+#define WAVEFORM_STREAM_KEYFRAME_INTERVAL 32
+
+/**
+ * @brief Copies the voltage and current samples to the stream ring while the stream is
+ * enabled. A block which does not fit is dropped. Called from the DMA interrupt
+ *
+ * @param block pointer to the first scan of the block
+ * @param scans number of scans in the block, ACQUISITION_BLOCK_SCANS
+ */
+void waveform_stream_process_block(const uint16_t* block, uint32_t scans);
+
+/**
+ * @brief Encodes and sends the frames stored in the ring while the USB accepts them.
+ * Called from the main loop
+ *
+ */
+void waveform_stream_handler(void);
+
+/**
+ * @brief Enables or disables the stream
+ *
+ * @param value 1 to enable and 0 to disable
+ */
+void waveform_stream_update_status(int32_t value);
@@ -0,0 +1,535 @@
+/**
+ * @file acquisition.c
+ * @brief Block based ADC acquisition. The ADC results are written by the DMA into a
+ * circular buffer split in two halves, and every time one half is filled it is handed
+ * to the electrical analyzer as a whole block.
+ *
+ */
+
+#include "application/acquisition.h"
+
+#include "application/capture.h"
+#include "application/electrical_analyzer.h"
+#include "application/oversampler.h"
+#include "application/spectrum_analyzer.h"
+#include "application/waveform_stream.h"
+#include "stm32f1xx_hal.h"
+#include "usbd_cdc_if.h"
+
+#include <stdio.h>
+
+#define ACQUISITION_BUFFER_SCANS (2 * ACQUISITION_BLOCK_SCANS)
+#define ACQUISITION_BUFFER_SIZE  (ACQUISITION_BUFFER_SCANS * ACQUISITION_NUM_CHANNELS)
+
+// Every conversion takes the 13.5 cycles of sampling time plus 12.5 cycles of conversion
+#define ADC_CYCLES_PER_CONVERSION 26
+// PCLK2 divided by 6, the ADC clock configured by main.c
+#define ADC_CLOCK_HZ              12000000
+#define MAX_TX_SIZE               100
+
+_Static_assert(ACQUISITION_HIGHEST_SAMPLE_RATE_HZ
+                       >= ADC_CLOCK_HZ
+                              / (ADC_CYCLES_PER_CONVERSION * ACQUISITION_NUM_CHANNELS)
+                   && ACQUISITION_HIGHEST_SAMPLE_RATE_HZ
+                          >= ACQUISITION_MAX_INJECTED_SAMPLE_RATE_HZ,
+               "The highest sample rate must not be lower than the rate of any mode");
+
+extern ADC_HandleTypeDef hadc1;
+extern ADC_HandleTypeDef hadc2;
+extern DMA_HandleTypeDef hdma_adc1;
+extern TIM_HandleTypeDef htim3;
+
+/**
+ * @brief Configures the ADC trigger for the current mode and starts the circular DMA
+ * transfer and the trigger timer if needed
+ *
+ */
+static void acquisition_start(void);
+
+/**
+ * @brief Stops the trigger timer and the DMA transfer
+ *
+ */
+static void acquisition_stop(void);
+
+/**
+ * @brief Restarts the acquisition in a new mode and sends the result
+ *
+ * @param mode new mode, one of acquisition_mode
+ */
+static void apply_mode(uint8_t mode);
+
+/**
+ * @brief Restarts the acquisition at a new sample rate if it is allowed in the current
+ * mode, and sends the result
+ *
+ * @param value new sample rate in Hz
+ */
+static void apply_sample_rate(int32_t value);
+
+/**
+ * @brief Reconfigures the regular sequence of an ADC with a new set of channels
+ *
+ * @param hadc adc instance
+ * @param channels channels to be converted, in rank order
+ * @param size number of channels in the sequence
+ */
+static void configure_regular_sequence(ADC_HandleTypeDef* hadc, const uint32_t* channels,
+                                       uint32_t size);
+
+/**
+ * @brief Configures the injected sequence of an ADC to convert one channel in a single
+ * rank, started by software
+ *
+ * @param hadc adc instance
+ * @param channel channel to be converted
+ */
+static void configure_injected_sequence(ADC_HandleTypeDef* hadc, uint32_t channel);
+
+/**
+ * @brief Hands a block to every module which processes the samples
+ *
+ * @param block pointer to the first scan of the block
+ */
+static void process_block(const uint16_t* block);
+
+/**
+ * @brief Gets the highest sample rate allowed in the current mode
+ *
+ * @return uint32_t sample rate in Hz
+ */
+static uint32_t get_max_sample_rate(void);
+
+/**
+ * @brief Configures TIM3 prescaler and period to overflow as close as possible to the
+ * requested rate. Every overflow generates a TRGO event that starts a scan
+ *
+ * @param rate_hz requested sample rate in Hz
+ */
+static void configure_trigger_timer(uint32_t rate_hz);
+
+// In single mode ADC1 converts all channels. In the dual modes ADC1 converts the even
+// ranks and ADC2 the odd ones, and since every DMA word holds ADC1 data in the lower half
+// and ADC2 data in the upper half, the buffer keeps the same layout. The injected layout
+// only uses the first rank of each ADC
+static const uint32_t single_sequence[] = {ADC_CHANNEL_2, ADC_CHANNEL_3, ADC_CHANNEL_0,
+                                           ADC_CHANNEL_1};
+static const uint32_t master_sequence[] = {ADC_CHANNEL_2, ADC_CHANNEL_0};
+static const uint32_t slave_sequence[]  = {ADC_CHANNEL_3, ADC_CHANNEL_1};
+
+static uint16_t adc_buf[ACQUISITION_BUFFER_SIZE];
+// Amount of values and of DMA transfers in one scan of the buffer
+static uint32_t scan_size          = ACQUISITION_NUM_CHANNELS;
+static uint32_t transfers_per_scan = ACQUISITION_NUM_CHANNELS;
+
+static uint8_t acquisition_mode       = acquisition_timer_triggered;
+static uint32_t triggered_sample_rate = ACQUISITION_DEFAULT_SAMPLE_RATE_HZ;
+// Exact trigger period, as a number of ticks of the timer clock
+static uint32_t trigger_timer_clock;
+static uint32_t trigger_timer_ticks;
+
+// Requested by the USB interrupt and applied by the main loop with the acquisition
+// stopped, so the DMA interrupt never runs while the ADC, the DMA or the timer are being
+// configured
+static volatile bool is_mode_requested;
+static volatile uint8_t requested_mode;
+static volatile bool is_rate_requested;
+static volatile int32_t requested_rate;
+
+/**
+ * @brief Calibrates the ADC and starts the circular DMA transfer into the block buffer
+ *
+ */
+void acquisition_init(void) {
+    // All STM32F1 devices allow self calibration. It should be done after every power-up
+    HAL_ADCEx_Calibration_Start(&hadc1);
+    HAL_ADCEx_Calibration_Start(&hadc2);
+    configure_trigger_timer(ACQUISITION_DEFAULT_SAMPLE_RATE_HZ);
+    acquisition_start();
+}
+
+/**
+ * @brief Applies the mode and sample rate changes requested by the commands. Called from
+ * the main loop
+ *
+ */
+void acquisition_handler(void) {
+    if (is_mode_requested) {
+        is_mode_requested = false;
+        apply_mode(requested_mode);
+    }
+    if (is_rate_requested) {
+        is_rate_requested = false;
+        apply_sample_rate(requested_rate);
+    }
+}
+
+/**
+ * @brief Stops the acquisition around work which would make the DMA interrupt miss
+ * blocks. Called from the main loop
+ *
+ */
+void acquisition_pause(void) {
+    acquisition_stop();
+}
+
+/**
+ * @brief Starts the acquisition stopped by acquisition_pause. The window in progress of
+ * the electrical analyzer is discarded, as it is missing the scans of the pause
+ *
+ */
+void acquisition_resume(void) {
+    acquisition_start();
+    electrical_analyzer_reset();
+}
+
+/**
+ * @brief Updates the mode in which the ADC scans are started. The acquisition is
+ * restarted by the main loop
+ *
+ * @param mode new mode, one of acquisition_mode
+ */
+void acquisition_update_mode(int32_t mode) {
+    char string_to_send[MAX_TX_SIZE];
+
+    if (mode >= 0 && mode < acquisition_mode_size) {
+        requested_mode    = mode;
+        is_mode_requested = true;
+        return;
+    }
+
+    const int32_t tam =
+        sprintf(string_to_send, "Mode not allowed, allowed modes are 0 to %d.\n",
+                acquisition_mode_size - 1);
+    if (tam > MAX_TX_SIZE) {
+        return;
+    }
+    CDC_Transmit_FS((uint8_t*)string_to_send, tam);
+}
+
+/**
+ * @brief Updates the rate of the timer which triggers the ADC scans. The value is
+ * checked and the acquisition restarted by the main loop, after any mode change
+ * requested before it
+ *
+ * @param value new sample rate in Hz, limited by ACQUISITION_MIN_SAMPLE_RATE_HZ and
+ * ACQUISITION_MAX_SAMPLE_RATE_HZ
+ */
+void acquisition_update_sample_rate(int32_t value) {
+    requested_rate    = value;
+    is_rate_requested = true;
+}
+
+/**
+ * @brief Gets the rate in which the scans are being acquired
+ *
+ * @return uint32_t sample rate in Hz
+ */
+uint32_t acquisition_get_sample_rate(void) {
+    if (acquisition_mode == acquisition_free_running) {
+        return HAL_RCCEx_GetPeriphCLKFreq(RCC_PERIPHCLK_ADC)
+               / (ADC_CYCLES_PER_CONVERSION * ACQUISITION_NUM_CHANNELS);
+    }
+    return triggered_sample_rate;
+}
+
+/**
+ * @brief Gets the rate in which the scans are being acquired without rounding it, to be
+ * used as time reference by the measurements that count samples
+ *
+ * @return uint64_t sample rate in uHz
+ */
+uint64_t acquisition_get_sample_rate_uHz(void) {
+    if (acquisition_mode == acquisition_free_running) {
+        return (uint64_t)HAL_RCCEx_GetPeriphCLKFreq(RCC_PERIPHCLK_ADC) * 1000000
+               / (ADC_CYCLES_PER_CONVERSION * ACQUISITION_NUM_CHANNELS);
+    }
+    return (uint64_t)trigger_timer_clock * 1000000 / trigger_timer_ticks;
+}
+
+/**
+ * @brief Gets the rate in which lux and temperature samples are delivered to the
+ * oversampler, lower than the sample rate when they are injected conversions
+ *
+ * @return uint32_t sample rate in Hz
+ */
+uint32_t acquisition_get_slow_sample_rate(void) {
+    if (acquisition_mode == acquisition_injected) {
+        return acquisition_get_sample_rate() / ACQUISITION_BLOCK_SCANS;
+    }
+    return acquisition_get_sample_rate();
+}
+
+/**
+ * @brief Gets how many values each scan of the blocks holds, which depends on the mode
+ *
+ * @return uint32_t ACQUISITION_NUM_CHANNELS, or ACQUISITION_NUM_FAST_CHANNELS when the
+ * slow channels are injected conversions
+ */
+uint32_t acquisition_get_scan_size(void) {
+    return scan_size;
+}
+
+/**
+ * @brief Gets the last complete scan written by the DMA. Used by the instant readings,
+ * which do not need to wait for a whole block to be completed
+ *
+ * @return const uint16_t* Pointer to the raw ADC values of the scan
+ */
+const uint16_t* acquisition_get_latest_scan(void) {
+    return acquisition_get_previous_scan(0);
+}
+
+/**
+ * @brief Gets a complete scan written by the DMA some scans before the latest one
+ *
+ * @param age how many scans before the latest one, limited to the buffer size
+ * @return const uint16_t* Pointer to the raw ADC values of the scan
+ */
+const uint16_t* acquisition_get_previous_scan(uint32_t age) {
+    if (age >= ACQUISITION_BUFFER_SCANS) {
+        age = ACQUISITION_BUFFER_SCANS - 1;
+    }
+    // The DMA counter holds how many transfers are left until the end of the buffer, so
+    // the scan being written right now is the one that contains the next transfer
+    const uint32_t written = ACQUISITION_BUFFER_SCANS * transfers_per_scan
+                             - __HAL_DMA_GET_COUNTER(&hdma_adc1);
+    const uint32_t scan =
+        (written / transfers_per_scan + ACQUISITION_BUFFER_SCANS - 1 - age)
+        % ACQUISITION_BUFFER_SCANS;
+    return &adc_buf[scan * scan_size];
+}
+
+/**
+ * @brief Called by the DMA when the first half of the buffer has been filled. The first
+ * half is processed while the DMA keeps writing into the second one
+ *
+ * @param hadc adc instance
+ */
+void HAL_ADC_ConvHalfCpltCallback(ADC_HandleTypeDef* hadc) {
+    if (hadc != &hadc1) {
+        return;
+    }
+    process_block(&adc_buf[0]);
+}
+
+/**
+ * @brief Called by the DMA when the second half of the buffer has been filled. The
+ * second half is processed while the DMA wraps around and writes into the first one
+ *
+ * @param hadc adc instance
+ */
+void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef* hadc) {
+    if (hadc != &hadc1) {
+        return;
+    }
+    process_block(&adc_buf[ACQUISITION_BLOCK_SCANS * scan_size]);
+}
+
+static void acquisition_start(void) {
+    const bool injected = acquisition_mode == acquisition_injected;
+    const bool dual     = injected || acquisition_mode == acquisition_simultaneous;
+
+    if (acquisition_mode == acquisition_free_running) {
+        hadc1.Init.ContinuousConvMode = ENABLE;
+        hadc1.Init.ExternalTrigConv   = ADC_SOFTWARE_START;
+    } else {
+        hadc1.Init.ContinuousConvMode = DISABLE;
+        hadc1.Init.ExternalTrigConv   = ADC_EXTERNALTRIGCONV_T3_TRGO;
+    }
+
+    scan_size = injected ? ACQUISITION_NUM_FAST_CHANNELS : ACQUISITION_NUM_CHANNELS;
+    if (dual) {
+        configure_regular_sequence(&hadc1, master_sequence, scan_size / 2);
+        configure_regular_sequence(&hadc2, slave_sequence, scan_size / 2);
+    } else {
+        configure_regular_sequence(&hadc1, single_sequence, scan_size);
+    }
+    if (injected) {
+        // Only the master is started, the slave converts along with it
+        configure_injected_sequence(&hadc1, ADC_CHANNEL_0);
+        configure_injected_sequence(&hadc2, ADC_CHANNEL_1);
+    }
+
+    // Both ADCs are disabled at this point, which is required to change the dual mode
+    ADC_MultiModeTypeDef multimode = {0};
+    if (injected) {
+        multimode.Mode = ADC_DUALMODE_REGSIMULT_INJECSIMULT;
+    } else if (dual) {
+        multimode.Mode = ADC_DUALMODE_REGSIMULT;
+    } else {
+        multimode.Mode = ADC_MODE_INDEPENDENT;
+    }
+    HAL_ADCEx_MultiModeConfigChannel(&hadc1, &multimode);
+
+    // In the dual modes ADC1 data register holds the results of both ADCs, so the DMA
+    // moves one word per pair of conversions
+    hdma_adc1.Init.PeriphDataAlignment =
+        dual ? DMA_PDATAALIGN_WORD : DMA_PDATAALIGN_HALFWORD;
+    hdma_adc1.Init.MemDataAlignment = dual ? DMA_MDATAALIGN_WORD
+                                           : DMA_MDATAALIGN_HALFWORD;
+    HAL_DMA_Init(&hdma_adc1);
+
+    // Start to directly transfer ADC results to memory. The DMA runs in circular mode
+    // over the whole buffer and generates one interrupt when the first half is filled
+    // and another one when the second half is filled, so each half can be processed as
+    // a block while the other one is being written. The shorter scans of the injected
+    // layout only use the beginning of the buffer
+    transfers_per_scan = dual ? scan_size / 2 : scan_size;
+    if (dual) {
+        HAL_ADCEx_MultiModeStart_DMA(&hadc1, (uint32_t*)adc_buf,
+                                     ACQUISITION_BUFFER_SCANS * transfers_per_scan);
+    } else {
+        HAL_ADC_Start_DMA(&hadc1, (uint32_t*)adc_buf,
+                          ACQUISITION_BUFFER_SCANS * transfers_per_scan);
+    }
+
+    if (injected) {
+        // The start of the master also converts the first slow samples
+        HAL_ADCEx_InjectedStart(&hadc2);
+        HAL_ADCEx_InjectedStart(&hadc1);
+    }
+    if (acquisition_mode != acquisition_free_running) {
+        HAL_TIM_Base_Start(&htim3);
+    }
+}
+
+static void acquisition_stop(void) {
+    HAL_TIM_Base_Stop(&htim3);
+    if (acquisition_mode == acquisition_simultaneous
+        || acquisition_mode == acquisition_injected) {
+        HAL_ADCEx_MultiModeStop_DMA(&hadc1);
+    } else {
+        HAL_ADC_Stop_DMA(&hadc1);
+    }
+    HAL_ADC_Stop(&hadc2);
+
+    if (acquisition_mode == acquisition_injected) {
+        HAL_ADCEx_InjectedStop(&hadc1);
+        HAL_ADCEx_InjectedStop(&hadc2);
+    }
+}
+
+static void apply_mode(uint8_t mode) {
+    char string_to_send[MAX_TX_SIZE];
+
+    acquisition_stop();
+    acquisition_mode = mode;
+    if (triggered_sample_rate > get_max_sample_rate()) {
+        configure_trigger_timer(get_max_sample_rate());
+    }
+    acquisition_start();
+    electrical_analyzer_reset();
+
+    const int32_t tam =
+        sprintf(string_to_send, "Acquisition mode set as %d, sample rate is %lu Hz.\n",
+                acquisition_mode, acquisition_get_sample_rate());
+    if (tam > MAX_TX_SIZE) {
+        return;
+    }
+    CDC_Transmit_FS((uint8_t*)string_to_send, tam);
+}
+
+static void apply_sample_rate(int32_t value) {
+    char string_to_send[MAX_TX_SIZE];
+    int32_t tam;
+
+    if (value >= ACQUISITION_MIN_SAMPLE_RATE_HZ
+        && (uint32_t)value <= get_max_sample_rate()) {
+        acquisition_stop();
+        configure_trigger_timer(value);
+        acquisition_start();
+        electrical_analyzer_reset();
+
+        tam = sprintf(string_to_send, "Sample rate set as %lu Hz.\n",
+                      triggered_sample_rate);
+    } else {
+        tam = sprintf(string_to_send,
+                      "Value not allowed, allowed sample rates are %d to %lu Hz.\n",
+                      ACQUISITION_MIN_SAMPLE_RATE_HZ, get_max_sample_rate());
+    }
+
+    if (tam > MAX_TX_SIZE) {
+        return;
+    }
+    CDC_Transmit_FS((uint8_t*)string_to_send, tam);
+}
+
+static void configure_regular_sequence(ADC_HandleTypeDef* hadc, const uint32_t* channels,
+                                       uint32_t size) {
+    ADC_ChannelConfTypeDef config = {0};
+
+    hadc->Init.NbrOfConversion = size;
+    HAL_ADC_Init(hadc);
+
+    config.SamplingTime = ADC_SAMPLETIME_13CYCLES_5;
+    for (uint32_t i = 0; i < size; i++) {
+        config.Channel = channels[i];
+        config.Rank    = ADC_REGULAR_RANK_1 + i;
+        HAL_ADC_ConfigChannel(hadc, &config);
+    }
+}
+
+static void configure_injected_sequence(ADC_HandleTypeDef* hadc, uint32_t channel) {
+    ADC_InjectionConfTypeDef config = {0};
+
+    config.InjectedChannel               = channel;
+    config.InjectedRank                  = ADC_INJECTED_RANK_1;
+    config.InjectedSamplingTime          = ADC_SAMPLETIME_13CYCLES_5;
+    config.InjectedNbrOfConversion       = 1;
+    config.InjectedDiscontinuousConvMode = DISABLE;
+    config.AutoInjectedConv              = DISABLE;
+    config.ExternalTrigInjecConv         = ADC_INJECTED_SOFTWARE_START;
+    HAL_ADCEx_InjectedConfigChannel(hadc, &config);
+}
+
+static void process_block(const uint16_t* block) {
+    electrical_analyzer_process_block(block, ACQUISITION_BLOCK_SCANS);
+    spectrum_analyzer_process_block(block, ACQUISITION_BLOCK_SCANS);
+    capture_process_block(block, ACQUISITION_BLOCK_SCANS);
+    waveform_stream_process_block(block, ACQUISITION_BLOCK_SCANS);
+
+    if (acquisition_mode != acquisition_injected) {
+        oversampler_process_block(&block[ACQUISITION_RANK_LUX], ACQUISITION_BLOCK_SCANS,
+                                  scan_size);
+        return;
+    }
+
+    // The injected data registers hold the conversion started by the previous block, lux
+    // by ADC1 and temperature by ADC2. The next one is started right away, it delays a
+    // single regular scan by one conversion time, well inside the scan period
+    const uint16_t slow_scan[2] = {
+        HAL_ADCEx_InjectedGetValue(&hadc1, ADC_INJECTED_RANK_1),
+        HAL_ADCEx_InjectedGetValue(&hadc2, ADC_INJECTED_RANK_1),
+    };
+    SET_BIT(hadc1.Instance->CR2, ADC_CR2_JSWSTART);
+    oversampler_process_block(slow_scan, 1, 2);
+}
+
+static uint32_t get_max_sample_rate(void) {
+    if (acquisition_mode == acquisition_injected) {
+        return ACQUISITION_MAX_INJECTED_SAMPLE_RATE_HZ;
+    }
+    return ACQUISITION_MAX_SAMPLE_RATE_HZ;
+}
+
+static void configure_trigger_timer(uint32_t rate_hz) {
+    // APB1 timers run at twice the bus clock whenever the APB1 prescaler is not 1
+    uint32_t timer_clock = HAL_RCC_GetPCLK1Freq();
+    if ((RCC->CFGR & RCC_CFGR_PPRE1) != RCC_HCLK_DIV1) {
+        timer_clock *= 2;
+    }
+
+    const uint32_t ticks     = timer_clock / rate_hz;
+    const uint32_t prescaler = (ticks - 1) / 65536;
+    const uint32_t period    = ticks / (prescaler + 1);
+
+    __HAL_TIM_SET_PRESCALER(&htim3, prescaler);
+    __HAL_TIM_SET_AUTORELOAD(&htim3, period - 1);
+    // Reload the prescaler now instead of waiting for the next overflow
+    htim3.Instance->EGR = TIM_EGR_UG;
+
+    trigger_timer_clock   = timer_clock;
+    trigger_timer_ticks   = (prescaler + 1) * period;
+    triggered_sample_rate = trigger_timer_clock / trigger_timer_ticks;
+}
@@ -0,0 +1,356 @@
+/**
+ * @file benchmark.c
+ * @brief Measures in CPU cycles the cost of the processing kernels on the target and
+ * sends the results through the USB
+ *
+ */
+
+#include "application/benchmark.h"
+
+#include "application/acquisition.h"
+#include "application/delta_codec.h"
+#include "application/fft.h"
+#include "application/fixed_math.h"
+#include "application/formatter.h"
+#include "application/harmonic_analyzer.h"
+#include "application/timer_handler.h"
+#include "application/unit_conversion.h"
+#include "stm32f1xx.h"
+#include "usbd_cdc_if.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#define BENCHMARK_ITERATIONS 64
+// The report has 278 characters of text and 18 values of at most 10 digits
+#define MAX_REPORT_SIZE 512
+// A line of three values, as the visualizer streams them
+#define MAX_LINE_SIZE 128
+
+#define PI 3.14159265358979323846
+
+// Length of the cycle given to the harmonic analyzer, in samples
+#define GOERTZEL_SAMPLES_PER_CYCLE 128
+// Scans compressed by the delta codec, the samples, the encoded bytes and the decoded
+// samples share the transform data
+#define CODEC_SCANS 128
+// Peak of the generated waveforms in codes, the voltage close to its nominal value
+#define CODEC_VOLTAGE_PEAK 1800
+#define CODEC_CURRENT_PEAK 600
+#define CODEC_FREQUENCY_HZ 60
+
+/**
+ * @brief Fills the input vector with pseudo random values spread over the whole 32 bit
+ * range, so the kernels are not measured only in their fastest paths
+ *
+ */
+static void generate_inputs(void);
+
+/**
+ * @brief Measures the integer square root used by the RMS calculation
+ *
+ * @return uint32_t average cycles per call
+ */
+static uint32_t benchmark_isqrt(void);
+
+/**
+ * @brief Measures the libm square root with the conversion from integer, as used before
+ * the integer square root
+ *
+ * @return uint32_t average cycles per call
+ */
+static uint32_t benchmark_libm_sqrt(void);
+
+/**
+ * @brief Measures the conversion of a voltage and a current code with the arithmetic of
+ * the calibration macros
+ *
+ * @return uint32_t average cycles per pair of conversions
+ */
+static uint32_t benchmark_conversion_macros(void);
+
+/**
+ * @brief Measures the conversion of a voltage and a current code with the tables
+ *
+ * @return uint32_t average cycles per pair of conversions
+ */
+static uint32_t benchmark_conversion_tables(void);
+
+/**
+ * @brief Measures one sample going through the Goertzel filters of every selected
+ * harmonic, for voltage and current
+ *
+ * @return uint32_t average cycles per sample
+ */
+static uint32_t benchmark_goertzel(void);
+
+/**
+ * @brief Fills the transform data with two tones and noise, as real values in Q15
+ *
+ * @param data interleaved complex data to fill
+ * @param points number of points to fill
+ */
+static void generate_fft_inputs(int16_t* data, uint32_t points);
+
+/**
+ * @brief Measures the Q15 FFT over inputs generated by generate_fft_inputs
+ *
+ * @param points number of points of the transform
+ * @return uint32_t cycles of one transform
+ */
+static uint32_t benchmark_fft(uint32_t points);
+
+/**
+ * @brief Measures a streamed line of three values written by sprintf
+ *
+ * @return uint32_t cycles per line
+ */
+static uint32_t benchmark_line_sprintf(void);
+
+/**
+ * @brief Measures the same line written by the formatter
+ *
+ * @return uint32_t cycles per line
+ */
+static uint32_t benchmark_line_formatter(void);
+
+/**
+ * @brief Fills interleaved voltage and current samples with sines of the mains frequency
+ * at the current sample rate and a few LSB of noise
+ *
+ * @param samples where the samples are written, CODEC_SCANS scans
+ */
+static void generate_codec_inputs(uint16_t* samples);
+
+/**
+ * @brief Measures the delta codec over inputs generated by generate_codec_inputs, and
+ * checks that the decoded samples are the same as the inputs
+ *
+ * @param size where the size of the encoded scans is written
+ * @param encode_cycles where the encoding cycles per scan are written
+ * @param decode_cycles where the decoding cycles per scan are written
+ * @return uint32_t number of decoded samples different from the inputs
+ */
+static uint32_t benchmark_delta_codec(uint32_t* size, uint32_t* encode_cycles,
+                                      uint32_t* decode_cycles);
+
+static uint32_t inputs[BENCHMARK_ITERATIONS];
+static int16_t fft_data[2 * FFT_MAX_POINTS];
+static volatile uint32_t sink;
+static char line[MAX_LINE_SIZE];
+static char report[MAX_REPORT_SIZE];
+// Requested by the USB interrupt, the benchmarks run in the main loop
+static volatile bool is_run_requested;
+
+/**
+ * @brief Requests every benchmark to be run by the main loop
+ *
+ */
+void benchmark_run(void) {
+    is_run_requested = true;
+}
+
+/**
+ * @brief Runs the requested benchmarks with the acquisition stopped and sends the cycles
+ * per call of each one. Called from the main loop
+ *
+ */
+void benchmark_handler(void) {
+    if (!is_run_requested) {
+        return;
+    }
+    is_run_requested = false;
+
+    generate_inputs();
+
+    // The DMA interrupt would miss blocks while its interrupt is masked, so the
+    // acquisition is stopped and the window in progress discarded when it starts again.
+    // The other interrupts are disabled so their handlers do not add to the measurement
+    acquisition_pause();
+    __disable_irq();
+    const uint32_t isqrt_cycles     = benchmark_isqrt();
+    const uint32_t libm_sqrt_cycles = benchmark_libm_sqrt();
+    const uint32_t macros_cycles    = benchmark_conversion_macros();
+    const uint32_t tables_cycles    = benchmark_conversion_tables();
+    const uint32_t goertzel_cycles  = benchmark_goertzel();
+    const uint32_t fft_512_cycles   = benchmark_fft(512);
+    const uint32_t fft_256_cycles   = benchmark_fft(256);
+    const uint32_t sprintf_cycles   = benchmark_line_sprintf();
+    const uint32_t formatter_cycles = benchmark_line_formatter();
+    uint32_t codec_size;
+    uint32_t encode_cycles;
+    uint32_t decode_cycles;
+    const uint32_t codec_errors =
+        benchmark_delta_codec(&codec_size, &encode_cycles, &decode_cycles);
+    __enable_irq();
+    acquisition_resume();
+
+    // Cycles available for each scan at the current sample rate
+    const uint32_t budget = SystemCoreClock / acquisition_get_sample_rate();
+    // Hundredths of a byte per scan, and of the ratio to the 4 bytes of a raw scan
+    const uint32_t bytes_per_scan = codec_size * 100 / CODEC_SCANS;
+    const uint32_t ratio          = 4 * CODEC_SCANS * 100 / codec_size;
+
+    const int32_t tam =
+        sprintf(report,
+                "sqrt cycles: integer %lu, libm %lu. Conversion cycles: macros %lu, "
+                "tables %lu. Goertzel cycles per sample: %lu for %u harmonics, budget "
+                "%lu. FFT cycles: 256 points %lu, 512 points %lu. "
+                "Line cycles: sprintf %lu, formatter %lu. Delta codec: %lu.%02lu bytes "
+                "per scan, ratio %lu.%02lu, cycles per scan: encode %lu, decode %lu, "
+                "%lu errors.\n",
+                isqrt_cycles, libm_sqrt_cycles, macros_cycles, tables_cycles,
+                goertzel_cycles,
+                __builtin_popcount(harmonic_analyzer_get_selection()), budget,
+                fft_256_cycles, fft_512_cycles, sprintf_cycles,
+                formatter_cycles, bytes_per_scan / 100, bytes_per_scan % 100,
+                ratio / 100, ratio % 100, encode_cycles, decode_cycles, codec_errors);
+
+    if (tam > MAX_REPORT_SIZE) {
+        return;
+    }
+    CDC_Transmit_FS((uint8_t*)report, tam);
+}
+
+static void generate_inputs(void) {
+    uint32_t seed = 0x12345678;
+    for (uint32_t i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        seed      = seed * 1664525 + 1013904223;
+        inputs[i] = seed >> (i % 32);
+    }
+}
+
+static uint32_t benchmark_isqrt(void) {
+    const uint32_t start = timer_update_cycles();
+    for (uint32_t i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        sink = fixed_math_isqrt32(inputs[i]);
+    }
+    return (timer_update_cycles() - start) / BENCHMARK_ITERATIONS;
+}
+
+static uint32_t benchmark_libm_sqrt(void) {
+    const uint32_t start = timer_update_cycles();
+    for (uint32_t i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        sink = sqrt(inputs[i]);
+    }
+    return (timer_update_cycles() - start) / BENCHMARK_ITERATIONS;
+}
+
+static uint32_t benchmark_conversion_macros(void) {
+    const uint32_t start = timer_update_cycles();
+    for (uint32_t i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        const uint32_t code = inputs[i] >> 20;
+        sink                = VOLTAGE_BIT_TO_REAL_V(code) + CURRENT_BIT_TO_REAL_mA(code);
+    }
+    return (timer_update_cycles() - start) / BENCHMARK_ITERATIONS;
+}
+
+static uint32_t benchmark_conversion_tables(void) {
+    const uint32_t start = timer_update_cycles();
+    for (uint32_t i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        const uint32_t code = inputs[i] >> 20;
+        sink = unit_conversion_voltage_V[code] + unit_conversion_current_mA[code];
+    }
+    return (timer_update_cycles() - start) / BENCHMARK_ITERATIONS;
+}
+
+static uint32_t benchmark_line_sprintf(void) {
+    const uint32_t start = timer_update_cycles();
+    for (uint32_t i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        const int32_t value = inputs[i];
+        sink = sprintf(line, "%ld mVrms, \t%ld uArms, \t%ld mW\n", value >> 12,
+                       value >> 8, value >> 16);
+    }
+    return (timer_update_cycles() - start) / BENCHMARK_ITERATIONS;
+}
+
+static uint32_t benchmark_line_formatter(void) {
+    const uint32_t start = timer_update_cycles();
+    for (uint32_t i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        const int32_t value = inputs[i];
+        int32_t length      = formatter_int(line, value >> 12);
+        length += formatter_text(line + length, " mVrms, \t");
+        length += formatter_int(line + length, value >> 8);
+        length += formatter_text(line + length, " uArms, \t");
+        length += formatter_int(line + length, value >> 16);
+        length += formatter_text(line + length, " mW\n");
+        sink = length;
+    }
+    return (timer_update_cycles() - start) / BENCHMARK_ITERATIONS;
+}
+
+static uint32_t benchmark_goertzel(void) {
+    // Overwrites the harmonics of the window in progress, which is measured again when
+    // the next one starts
+    harmonic_analyzer_start_window(GOERTZEL_SAMPLES_PER_CYCLE << 16, 1);
+
+    const uint32_t start = timer_update_cycles();
+    for (uint32_t i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        harmonic_analyzer_update(inputs[i] >> 21, inputs[i] >> 22);
+    }
+    return (timer_update_cycles() - start) / BENCHMARK_ITERATIONS;
+}
+
+static void generate_fft_inputs(int16_t* data, uint32_t points) {
+    uint32_t seed = 0x12345678;
+    for (uint32_t n = 0; n < points; n++) {
+        seed = seed * 1664525 + 1013904223;
+        // A tone between bins, a tone in a bin and noise of +-512 LSB
+        const double tone = 12000 * sin(2 * PI * 5.3 * n / points) +
+                            3000 * cos(2 * PI * 17 * n / points);
+        data[2 * n]     = (int16_t)tone + (int16_t)(seed >> 22) - 512;
+        data[2 * n + 1] = 0;
+    }
+}
+
+static uint32_t benchmark_fft(uint32_t points) {
+    generate_fft_inputs(fft_data, points);
+
+    const uint32_t start = timer_update_cycles();
+    fft_q15(fft_data, points);
+    return timer_update_cycles() - start;
+}
+
+static void generate_codec_inputs(uint16_t* samples) {
+    const double step = 2 * PI * CODEC_FREQUENCY_HZ / acquisition_get_sample_rate();
+    uint32_t seed     = 0x12345678;
+    for (uint32_t n = 0; n < CODEC_SCANS; n++) {
+        seed = seed * 1664525 + 1013904223;
+        // Two bits of noise for each channel, from -2 to 1 LSB
+        const int32_t noise_voltage = (int32_t)(seed >> 30) - 2;
+        const int32_t noise_current = (int32_t)((seed >> 28) & 0x3) - 2;
+        samples[2 * n] =
+            2048 + (int32_t)(CODEC_VOLTAGE_PEAK * sin(step * n)) + noise_voltage;
+        samples[2 * n + 1] =
+            2048 + (int32_t)(CODEC_CURRENT_PEAK * sin(step * n - PI / 6)) + noise_current;
+    }
+}
+
+static uint32_t benchmark_delta_codec(uint32_t* size, uint32_t* encode_cycles,
+                                      uint32_t* decode_cycles) {
+    uint16_t* samples = (uint16_t*)fft_data;
+    uint16_t* decoded = &samples[2 * CODEC_SCANS];
+    uint8_t* encoded  = (uint8_t*)&decoded[2 * CODEC_SCANS];
+    _Static_assert(2 * DELTA_CODEC_CHANNELS * CODEC_SCANS * sizeof(uint16_t)
+                           + DELTA_CODEC_MAX_SIZE(CODEC_SCANS)
+                       <= sizeof(fft_data),
+                   "The codec buffers must fit in the transform data");
+
+    generate_codec_inputs(samples);
+
+    struct delta_codec codec;
+    uint32_t start = timer_update_cycles();
+    *size          = delta_codec_encode(&codec, samples, CODEC_SCANS, true, encoded);
+    *encode_cycles = (timer_update_cycles() - start) / CODEC_SCANS;
+
+    start = timer_update_cycles();
+    delta_codec_decode(&codec, encoded, *size, CODEC_SCANS, true, decoded);
+    *decode_cycles = (timer_update_cycles() - start) / CODEC_SCANS;
+
+    uint32_t errors = 0;
+    for (uint32_t i = 0; i < 2 * CODEC_SCANS; i++) {
+        errors += decoded[i] != samples[i];
+    }
+    return errors;
+}
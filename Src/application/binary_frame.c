@@ -0,0 +1,193 @@
+/**
+ * @file binary_frame.c
+ * @brief Encodes the streamed values as binary records framed with COBS. Every record is
+ * the channel, the number of values, a sequence counter, the values as little endian
+ * 32 bit integers and a CRC-16/CCITT-FALSE of all of them. After COBS the record has no
+ * zero bytes, so a zero byte ends every frame and the host can resynchronize on it.
+ * Records of other streams carry an encoded payload instead of the values, and the count
+ * is defined by the stream
+ *
+ */
+
+#include "application/binary_frame.h"
+
+#define CRC16_INITIAL_VALUE 0xFFFF
+// Longest run of COBS, a code byte of 0xFF is followed by 254 non zero bytes
+#define COBS_MAX_RUN 0xFF
+
+/**
+ * @brief Writes a 16 bit value in little endian
+ *
+ * @param buffer where the value is written
+ * @param value value to be written
+ * @return uint8_t* position after the value
+ */
+static uint8_t* put_u16(uint8_t* buffer, uint16_t value);
+
+/**
+ * @brief Writes a 32 bit value in little endian
+ *
+ * @param buffer where the value is written
+ * @param value value to be written
+ * @return uint8_t* position after the value
+ */
+static uint8_t* put_u32(uint8_t* buffer, uint32_t value);
+
+/**
+ * @brief Writes the header of a record, before its payload
+ *
+ * @param record where the header is written
+ * @param channel id of the streamed channel
+ * @param count count field of the record
+ * @param sequence counter of the record
+ * @return uint8_t* position of the payload
+ */
+static uint8_t* put_header(uint8_t* record, uint8_t channel, uint8_t count,
+                           uint16_t sequence);
+
+/**
+ * @brief Appends the CRC to a record and encodes it into a frame
+ *
+ * @param record record with the header and the payload
+ * @param end position after the payload
+ * @param frame where the frame is written, BINARY_FRAME_MAX_SIZE bytes
+ * @return uint32_t size of the frame, including the delimiter
+ */
+static uint32_t finish_record(uint8_t* record, uint8_t* end, uint8_t* frame);
+
+/**
+ * @brief Encodes a buffer with Consistent Overhead Byte Stuffing and ends it with the
+ * zero delimiter
+ *
+ * @param data buffer to be encoded
+ * @param size size of the buffer
+ * @param frame where the encoded buffer is written
+ * @return uint32_t size of the frame, including the delimiter
+ */
+static uint32_t cobs_encode(const uint8_t* data, uint32_t size, uint8_t* frame);
+
+// CRC of every nibble for the polynomial 0x1021, the CRC is updated 4 bits at a time,
+// which is fast and takes only 32 bytes of flash
+static const uint16_t crc16_nibble_table[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+};
+
+// Record being encoded, kept out of the stack. The frames are only encoded by the main
+// loop, one at a time
+static uint8_t record_buffer[BINARY_FRAME_MAX_RECORD_SIZE];
+
+/**
+ * @brief Encodes a record of values into a frame
+ *
+ * @param channel id of the streamed channel
+ * @param sequence counter of the record, incremented by the caller for every record
+ * @param values values of the record
+ * @param count number of values, limited by BINARY_FRAME_MAX_VALUES
+ * @param frame where the frame is written, BINARY_FRAME_MAX_SIZE bytes
+ * @return uint32_t size of the frame, including the delimiter
+ */
+uint32_t binary_frame_encode(uint8_t channel, uint16_t sequence, const int32_t* values,
+                             uint32_t count, uint8_t* frame) {
+    if (count > BINARY_FRAME_MAX_VALUES) {
+        count = BINARY_FRAME_MAX_VALUES;
+    }
+
+    uint8_t* position = put_header(record_buffer, channel, count, sequence);
+    for (uint32_t i = 0; i < count; i++) {
+        position = put_u32(position, values[i]);
+    }
+
+    return finish_record(record_buffer, position, frame);
+}
+
+/**
+ * @brief Encodes a record with an already encoded payload into a frame
+ *
+ * @param channel id of the streamed channel
+ * @param count count field of the record, its meaning is defined by the channel
+ * @param sequence counter of the record, incremented by the caller for every record
+ * @param payload payload of the record
+ * @param size size of the payload, limited by BINARY_FRAME_MAX_PAYLOAD_SIZE
+ * @param frame where the frame is written, BINARY_FRAME_MAX_SIZE bytes
+ * @return uint32_t size of the frame, including the delimiter
+ */
+uint32_t binary_frame_encode_payload(uint8_t channel, uint8_t count, uint16_t sequence,
+                                     const uint8_t* payload, uint32_t size,
+                                     uint8_t* frame) {
+    if (size > BINARY_FRAME_MAX_PAYLOAD_SIZE) {
+        size = BINARY_FRAME_MAX_PAYLOAD_SIZE;
+    }
+
+    uint8_t* position = put_header(record_buffer, channel, count, sequence);
+    for (uint32_t i = 0; i < size; i++) {
+        *position++ = payload[i];
+    }
+
+    return finish_record(record_buffer, position, frame);
+}
+
+/**
+ * @brief Calculates the CRC-16/CCITT-FALSE of a buffer
+ *
+ * @param data buffer
+ * @param size size of the buffer
+ * @return uint16_t crc
+ */
+uint16_t binary_frame_crc16(const uint8_t* data, uint32_t size) {
+    uint16_t crc = CRC16_INITIAL_VALUE;
+    for (uint32_t i = 0; i < size; i++) {
+        crc = (crc << 4) ^ crc16_nibble_table[(crc >> 12) ^ (data[i] >> 4)];
+        crc = (crc << 4) ^ crc16_nibble_table[(crc >> 12) ^ (data[i] & 0x0F)];
+    }
+    return crc;
+}
+
+static uint8_t* put_u16(uint8_t* buffer, uint16_t value) {
+    buffer[0] = value;
+    buffer[1] = value >> 8;
+    return buffer + 2;
+}
+
+static uint8_t* put_u32(uint8_t* buffer, uint32_t value) {
+    buffer[0] = value;
+    buffer[1] = value >> 8;
+    buffer[2] = value >> 16;
+    buffer[3] = value >> 24;
+    return buffer + 4;
+}
+
+static uint8_t* put_header(uint8_t* record, uint8_t channel, uint8_t count,
+                           uint16_t sequence) {
+    record[0] = channel;
+    record[1] = count;
+    return put_u16(record + 2, sequence);
+}
+
+static uint32_t finish_record(uint8_t* record, uint8_t* end, uint8_t* frame) {
+    end = put_u16(end, binary_frame_crc16(record, end - record));
+    return cobs_encode(record, end - record, frame);
+}
+
+static uint32_t cobs_encode(const uint8_t* data, uint32_t size, uint8_t* frame) {
+    // Each code byte holds the distance to the next zero, written once the run ends
+    uint8_t* code_position = frame;
+    uint8_t* position      = frame + 1;
+    uint8_t code           = 1;
+
+    for (uint32_t i = 0; i < size; i++) {
+        if (data[i] != 0) {
+            *position++ = data[i];
+            code++;
+        }
+        if (data[i] == 0 || code == COBS_MAX_RUN) {
+            *code_position = code;
+            code_position  = position++;
+            code           = 1;
+        }
+    }
+    *code_position = code;
+    *position++    = 0;
+
+    return position - frame;
+}
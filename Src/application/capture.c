@@ -0,0 +1,326 @@
+/**
+ * @file capture.c
+ * @brief Oscilloscope style capture of the raw voltage and current samples. A ring keeps
+ * the samples before the trigger, and after the trigger condition is met the ring is
+ * frozen once the post trigger samples are stored, so it can be downloaded over the USB
+ *
+ */
+
+#include "application/capture.h"
+
+#include "application/acquisition.h"
+#include "stm32f1xx.h"
+#include "usbd_cdc_if.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#define CAPTURE_MASK (CAPTURE_SAMPLES - 1)
+#define MAX_TX_SIZE  100
+// Scans queued to the USB at once, a quarter of its transmission ring
+#define CHUNK_SCANS 64
+
+enum {
+    state_idle,
+    // Filling the ring and waiting for the trigger condition
+    state_armed,
+    // Storing the samples after the trigger
+    state_triggered,
+    // The ring is complete and kept until it is downloaded or armed again
+    state_frozen,
+    // The header and then the samples are sent, in chunks, oldest first
+    state_sending_header,
+    state_sending_samples,
+};
+
+/**
+ * @brief Checks the trigger condition with the last two samples of the trigger channel
+ *
+ * @param previous sample before the current one
+ * @param current latest sample
+ * @return true if the condition is met
+ */
+static bool is_triggered(uint16_t previous, uint16_t current);
+
+/**
+ * @brief Sends a text message through the USB
+ *
+ * @param message text to be sent
+ * @param tam size of the text, nothing is sent when larger than MAX_TX_SIZE
+ */
+static void send_message(const char* message, int32_t tam);
+
+static volatile uint32_t state = state_idle;
+static volatile bool is_freeze_notified;
+
+static enum capture_condition condition = capture_rising_edge;
+static enum capture_channel channel     = capture_voltage;
+static uint16_t level                   = CAPTURE_DEFAULT_LEVEL;
+static uint32_t pre_trigger             = CAPTURE_DEFAULT_PRE;
+static uint32_t hold_off;
+
+// Configuration latched when the capture was armed, used by the interrupt
+static enum capture_condition armed_condition;
+static uint32_t armed_rank;
+static uint16_t armed_level;
+static uint32_t armed_pre_trigger;
+static uint32_t armed_hold_off;
+
+// Raw codes of voltage and current of every scan
+static uint16_t ring[CAPTURE_SAMPLES][2];
+static uint32_t ring_index;
+// Samples stored since armed, and samples still to be stored after the trigger
+static uint32_t armed_samples;
+static uint32_t remaining_samples;
+static uint16_t previous_sample;
+// Scans already sent of a download
+static uint32_t sent_scans;
+
+/**
+ * @brief Stores the samples in the ring and checks the trigger condition while the
+ * capture is armed. Called from the DMA interrupt
+ *
+ * @param block pointer to the first scan of the block
+ * @param scans number of scans in the block
+ */
+void capture_process_block(const uint16_t* block, uint32_t scans) {
+    if (state != state_armed && state != state_triggered) {
+        return;
+    }
+
+    const uint32_t scan_size = acquisition_get_scan_size();
+    for (uint32_t i = 0; i < scans; i++, block += scan_size) {
+        uint16_t* sample = ring[ring_index++ & CAPTURE_MASK];
+        sample[0]        = block[ACQUISITION_RANK_VOLTAGE];
+        sample[1]        = block[ACQUISITION_RANK_CURRENT];
+
+        if (state == state_triggered) {
+            if (--remaining_samples == 0) {
+                state = state_frozen;
+                return;
+            }
+            continue;
+        }
+
+        // The ring must hold the pre trigger samples before the trigger is accepted
+        const uint16_t current = block[armed_rank];
+        if (++armed_samples > armed_pre_trigger && armed_samples > armed_hold_off
+            && is_triggered(previous_sample, current)) {
+            // The trigger sample is the first one after the pre trigger samples
+            remaining_samples = CAPTURE_SAMPLES - armed_pre_trigger - 1;
+            if (remaining_samples == 0) {
+                state = state_frozen;
+                return;
+            }
+            state = state_triggered;
+        }
+        previous_sample = current;
+    }
+}
+
+/**
+ * @brief Notifies a frozen capture and sends its samples when a download was requested.
+ * Called from the main loop
+ *
+ */
+void capture_handler(void) {
+    char string_to_send[MAX_TX_SIZE];
+    int32_t tam;
+
+    switch (state) {
+        case state_frozen:
+            if (!is_freeze_notified) {
+                is_freeze_notified = true;
+                tam = sprintf(string_to_send, "Capture triggered, send capread.\n");
+                send_message(string_to_send, tam);
+            }
+            break;
+        case state_sending_header:
+            tam = sprintf(string_to_send,
+                          "Capture: %u scans, %lu pre trigger, %lu Hz, %u bytes.\n",
+                          CAPTURE_SAMPLES, armed_pre_trigger,
+                          acquisition_get_sample_rate(), sizeof(ring));
+            if (tam <= MAX_TX_SIZE
+                && CDC_Transmit_FS((uint8_t*)string_to_send, tam) == USBD_OK) {
+                sent_scans = 0;
+                state      = state_sending_samples;
+            }
+            break;
+        case state_sending_samples: {
+            // The oldest sample is the next one that would have been written. A chunk
+            // never goes past the end of the ring, and is retried while the USB is full
+            const uint32_t first = (ring_index + sent_scans) & CAPTURE_MASK;
+            const uint32_t left  = CAPTURE_SAMPLES - sent_scans;
+            uint32_t scans       = CAPTURE_SAMPLES - first;
+            scans                = scans < left ? scans : left;
+            scans                = scans < CHUNK_SCANS ? scans : CHUNK_SCANS;
+            if (CDC_Transmit_FS((uint8_t*)ring[first], scans * sizeof(ring[0]))
+                == USBD_OK) {
+                sent_scans += scans;
+                if (sent_scans == CAPTURE_SAMPLES) {
+                    state = state_idle;
+                }
+            }
+            break;
+        }
+        default: {
+        }
+    }
+}
+
+/**
+ * @brief Starts filling the ring and waiting for the trigger condition
+ *
+ */
+void capture_arm(void) {
+    char string_to_send[MAX_TX_SIZE];
+
+    state              = state_idle;
+    is_freeze_notified = false;
+    armed_condition    = condition;
+    armed_rank = channel == capture_voltage ? ACQUISITION_RANK_VOLTAGE
+                                            : ACQUISITION_RANK_CURRENT;
+    armed_level       = level;
+    armed_pre_trigger = pre_trigger;
+    armed_hold_off    = hold_off;
+    armed_samples     = 0;
+    previous_sample   = level;
+    // The configuration must be visible to the interrupt before the capture starts
+    __DMB();
+    state = state_armed;
+
+    const int32_t tam = sprintf(string_to_send, "Capture armed.\n");
+    send_message(string_to_send, tam);
+}
+
+/**
+ * @brief Requests the download of a frozen capture. The samples are sent as binary, two
+ * little endian 16 bit raw codes per scan, voltage and current, oldest first
+ *
+ */
+void capture_download(void) {
+    char string_to_send[MAX_TX_SIZE];
+
+    if (state == state_frozen) {
+        state = state_sending_header;
+        return;
+    }
+    const int32_t tam = sprintf(string_to_send, "No capture to download.\n");
+    send_message(string_to_send, tam);
+}
+
+/**
+ * @brief Updates the trigger condition
+ *
+ * @param value condition, one of capture_condition
+ */
+void capture_update_condition(int32_t value) {
+    char string_to_send[MAX_TX_SIZE];
+    int32_t tam;
+
+    if (value >= 0 && value < capture_condition_size) {
+        condition = value;
+        tam       = sprintf(string_to_send, "Trigger condition set as %d.\n", condition);
+    } else {
+        tam = sprintf(string_to_send,
+                      "Value not allowed, 0 above, 1 below, 2 rising or 3 falling.\n");
+    }
+    send_message(string_to_send, tam);
+}
+
+/**
+ * @brief Updates the trigger level
+ *
+ * @param value level as a raw ADC code
+ */
+void capture_update_level(int32_t value) {
+    char string_to_send[MAX_TX_SIZE];
+    int32_t tam;
+
+    if (value >= 0 && value <= 4095) {
+        level = value;
+        tam   = sprintf(string_to_send, "Trigger level set as %u.\n", level);
+    } else {
+        tam = sprintf(string_to_send,
+                      "Value not allowed, allowed levels are 0 to 4095.\n");
+    }
+    send_message(string_to_send, tam);
+}
+
+/**
+ * @brief Updates the channel compared with the trigger level
+ *
+ * @param value channel, one of capture_channel
+ */
+void capture_update_channel(int32_t value) {
+    char string_to_send[MAX_TX_SIZE];
+    int32_t tam;
+
+    if (value >= 0 && value < capture_channel_size) {
+        channel = value;
+        tam     = sprintf(string_to_send, "Trigger channel set as %s.\n",
+                          channel == capture_voltage ? "voltage" : "current");
+    } else {
+        tam = sprintf(string_to_send,
+                      "Value not allowed, 0 for voltage or 1 for current.\n");
+    }
+    send_message(string_to_send, tam);
+}
+
+/**
+ * @brief Updates how many of the captured samples are taken before the trigger
+ *
+ * @param value pre trigger samples, below CAPTURE_SAMPLES
+ */
+void capture_update_pre_trigger(int32_t value) {
+    char string_to_send[MAX_TX_SIZE];
+    int32_t tam;
+
+    if (value >= 0 && value < CAPTURE_SAMPLES) {
+        pre_trigger = value;
+        tam = sprintf(string_to_send, "Pre trigger set as %lu scans.\n", pre_trigger);
+    } else {
+        tam = sprintf(string_to_send,
+                      "Value not allowed, allowed pre trigger is 0 to %d scans.\n",
+                      CAPTURE_SAMPLES - 1);
+    }
+    send_message(string_to_send, tam);
+}
+
+/**
+ * @brief Updates the hold off, the samples after arming in which the trigger is ignored
+ *
+ * @param value hold off samples, limited by CAPTURE_MAX_HOLD_OFF
+ */
+void capture_update_hold_off(int32_t value) {
+    char string_to_send[MAX_TX_SIZE];
+    int32_t tam;
+
+    if (value >= 0 && value <= CAPTURE_MAX_HOLD_OFF) {
+        hold_off = value;
+        tam      = sprintf(string_to_send, "Hold off set as %lu scans.\n", hold_off);
+    } else {
+        tam = sprintf(string_to_send,
+                      "Value not allowed, allowed hold off is 0 to %d scans.\n",
+                      CAPTURE_MAX_HOLD_OFF);
+    }
+    send_message(string_to_send, tam);
+}
+
+static bool is_triggered(uint16_t previous, uint16_t current) {
+    switch (armed_condition) {
+        case capture_level_above: return current >= armed_level;
+        case capture_level_below: return current < armed_level;
+        case capture_rising_edge: return previous < armed_level && current >= armed_level;
+        case capture_falling_edge:
+            return previous >= armed_level && current < armed_level;
+        default: return false;
+    }
+}
+
+static void send_message(const char* message, int32_t tam) {
+    if (tam > MAX_TX_SIZE) {
+        return;
+    }
+    CDC_Transmit_FS((uint8_t*)message, tam);
+}
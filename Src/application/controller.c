@@ -1,8 +1,17 @@
 #include "application/controller.h"
 
+#include "application/acquisition.h"
+#include "application/benchmark.h"
+#include "application/capture.h"
 #include "application/electrical_analyzer.h"
+#include "application/frequency_analyzer.h"
+#include "application/harmonic_analyzer.h"
+#include "application/oversampler.h"
+#include "application/power_quality.h"
+#include "application/spectrum_analyzer.h"
 #include "application/timer_handler.h"
 #include "application/visualizer.h"
+#include "application/waveform_stream.h"
 #include "main.h"
 
 #include <stdlib.h>
@@ -33,18 +42,26 @@ void controller_init(void) {
     module_stop();
     electrical_analyzer_init();
     timer_us_init();
+    timer_cycles_init();
 }
 
 /**
  * @brief Function to be called at code execution, similar to a arduino loop() function.
- * Does nothing if controller status is false
+ * The acquisition, the electrical analyzer and the benchmark run even if controller
+ * status is false, so the energy is integrated from the boot
  *
  */
 void controller_handler(void) {
+    acquisition_handler();
+    electrical_analyzer_handler();
+    benchmark_handler();
     if (!controller_status) {
         return;
     }
-    electrical_analyzer_handler();
+    spectrum_analyzer_handler();
+    capture_handler();
+    power_quality_handler();
+    waveform_stream_handler();
     visualizer_handler();
 }
 
@@ -67,6 +84,65 @@ void controller_receive_message(char* message, uint32_t size) {
         visualizer_update_channels(atoi(&message[4]));
     } else if (strncmp(message, "freq", 4) == 0) {
         visualizer_update_frequency(atoi(&message[4]));
+    } else if (strncmp(message, "sub", 3) == 0) {
+        // The frequency is optional, after a comma
+        char* frequency;
+        const int32_t channel = strtol(&message[3], &frequency, 10);
+        visualizer_subscribe(channel, *frequency == ',' ? atoi(&frequency[1]) : 0);
+    } else if (strncmp(message, "unsub", 5) == 0) {
+        visualizer_unsubscribe(atoi(&message[5]));
+    } else if (strncmp(message, "format", 6) == 0) {
+        visualizer_update_format(atoi(&message[6]));
+    } else if (strncmp(message, "rate", 4) == 0) {
+        acquisition_update_sample_rate(atoi(&message[4]));
+    } else if (strncmp(message, "mode", 4) == 0) {
+        acquisition_update_mode(atoi(&message[4]));
+    } else if (strncmp(message, "cycles", 6) == 0) {
+        electrical_analyzer_update_window_cycles(atoi(&message[6]));
+    } else if (strncmp(message, "harm", 4) == 0) {
+        harmonic_analyzer_update_selection(strtol(&message[4], NULL, 0));
+    } else if (strncmp(message, "fftn", 4) == 0) {
+        spectrum_analyzer_update_points(atoi(&message[4]));
+    } else if (strncmp(message, "fftc", 4) == 0) {
+        spectrum_analyzer_update_channel(atoi(&message[4]));
+    } else if (strncmp(message, "fcycles", 7) == 0) {
+        frequency_analyzer_update_cycles(atoi(&message[7]));
+    } else if (strncmp(message, "energyreset", 11) == 0) {
+        electrical_analyzer_reset_energy();
+    } else if (strncmp(message, "energy", 6) == 0) {
+        electrical_analyzer_show_energy();
+    } else if (strncmp(message, "peakreset", 9) == 0) {
+        electrical_analyzer_clear_peak_hold();
+    } else if (strncmp(message, "phase", 5) == 0) {
+        electrical_analyzer_update_phase_delay(atoi(&message[5]));
+    } else if (strncmp(message, "orate", 5) == 0) {
+        oversampler_update_output_rate(atoi(&message[5]));
+    } else if (strncmp(message, "pqdip", 5) == 0) {
+        power_quality_update_dip(atoi(&message[5]));
+    } else if (strncmp(message, "pqswell", 7) == 0) {
+        power_quality_update_swell(atoi(&message[7]));
+    } else if (strncmp(message, "pqint", 5) == 0) {
+        power_quality_update_interruption(atoi(&message[5]));
+    } else if (strncmp(message, "pqevents", 8) == 0) {
+        power_quality_drain_events();
+    } else if (strncmp(message, "trigmode", 8) == 0) {
+        capture_update_condition(atoi(&message[8]));
+    } else if (strncmp(message, "triglevel", 9) == 0) {
+        capture_update_level(atoi(&message[9]));
+    } else if (strncmp(message, "trigch", 6) == 0) {
+        capture_update_channel(atoi(&message[6]));
+    } else if (strncmp(message, "trigpre", 7) == 0) {
+        capture_update_pre_trigger(atoi(&message[7]));
+    } else if (strncmp(message, "trighold", 8) == 0) {
+        capture_update_hold_off(atoi(&message[8]));
+    } else if (strncmp(message, "caparm", 6) == 0) {
+        capture_arm();
+    } else if (strncmp(message, "capread", 7) == 0) {
+        capture_download();
+    } else if (strncmp(message, "wave", 4) == 0) {
+        waveform_stream_update_status(atoi(&message[4]));
+    } else if (strncmp(message, "bench", 5) == 0) {
+        benchmark_run();
     }
 }
 
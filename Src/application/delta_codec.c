@@ -0,0 +1,142 @@
+/**
+ * @file delta_codec.c
+ * @brief Compresses the raw voltage and current codes of consecutive scans. Every sample
+ * is replaced by its difference to the previous sample of the same channel, the
+ * difference is zig-zag mapped so small negative values stay small, and written as a
+ * LEB128 varint, 7 bits per byte with the high bit set while more bytes follow. A 50 or
+ * 60 Hz sine changes little from scan to scan, so most samples take a single byte.
+ * Keyframes start again from zero, so a decoder can join the stream on any of them. It
+ * does not depend on the HAL, so the same file decodes the stream on the host
+ *
+ */
+
+#include "application/delta_codec.h"
+
+#define VARINT_PAYLOAD_MASK 0x7F
+#define VARINT_CONTINUATION 0x80
+#define SAMPLE_MASK         0x0FFF
+
+/**
+ * @brief Encodes a sample as the zig-zag mapped difference to the previous one
+ *
+ * @param output where the difference is written
+ * @param previous last sample of the channel, updated with the new one
+ * @param sample new sample
+ * @return uint32_t number of bytes written
+ */
+static uint32_t encode_sample(uint8_t* output, uint16_t* previous, uint16_t sample);
+
+/**
+ * @brief Encodes scans as differences to the previous ones
+ *
+ * @param codec state of the stream, the same one for all the scans of a stream
+ * @param samples interleaved 12 bit samples, voltage and current of every scan
+ * @param scans number of scans
+ * @param is_keyframe true to encode the first scan from zero instead of from the last
+ * scan encoded, so it can be decoded alone
+ * @param output where the scans are written, DELTA_CODEC_MAX_SIZE(scans) bytes
+ * @return uint32_t number of bytes written
+ */
+uint32_t delta_codec_encode(struct delta_codec* codec, const uint16_t* samples,
+                            uint32_t scans, bool is_keyframe, uint8_t* output) {
+    uint32_t size = 0;
+
+    if (is_keyframe) {
+        codec->previous[0] = 0;
+        codec->previous[1] = 0;
+    }
+    for (uint32_t i = 0; i < scans; i++, samples += DELTA_CODEC_CHANNELS) {
+        size += encode_sample(&output[size], &codec->previous[0], samples[0]);
+        size += encode_sample(&output[size], &codec->previous[1], samples[1]);
+    }
+    return size;
+}
+
+/**
+ * @brief Decodes scans encoded by delta_codec_encode
+ *
+ * @param codec state of the stream, only used by delta frames when the previous frames
+ * were decoded
+ * @param input encoded scans
+ * @param size size of the input
+ * @param scans number of scans to be decoded
+ * @param is_keyframe true when the scans were encoded as a keyframe
+ * @param samples where the interleaved samples are written
+ * @return uint32_t number of bytes read, zero when the input is truncated or malformed
+ */
+uint32_t delta_codec_decode(struct delta_codec* codec, const uint8_t* input,
+                            uint32_t size, uint32_t scans, bool is_keyframe,
+                            uint16_t* samples) {
+    uint32_t position = 0;
+
+    if (is_keyframe) {
+        codec->previous[0] = 0;
+        codec->previous[1] = 0;
+    }
+    for (uint32_t i = 0; i < scans * DELTA_CODEC_CHANNELS; i++) {
+        uint32_t zigzag;
+        const uint32_t length =
+            delta_codec_get_varint(&input[position], size - position, &zigzag);
+        if (length == 0) {
+            return 0;
+        }
+        position += length;
+
+        uint16_t* previous   = &codec->previous[i % DELTA_CODEC_CHANNELS];
+        const int32_t delta  = (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+        const int32_t sample = *previous + delta;
+        if (sample < 0 || sample > SAMPLE_MASK) {
+            return 0;
+        }
+        *previous  = sample;
+        samples[i] = sample;
+    }
+    return position;
+}
+
+/**
+ * @brief Writes an unsigned value as a LEB128 varint
+ *
+ * @param output where the value is written, DELTA_CODEC_MAX_VARINT_SIZE bytes at most
+ * @param value value to be written
+ * @return uint32_t number of bytes written
+ */
+uint32_t delta_codec_put_varint(uint8_t* output, uint32_t value) {
+    uint32_t size = 0;
+    while (value > VARINT_PAYLOAD_MASK) {
+        output[size++] = (value & VARINT_PAYLOAD_MASK) | VARINT_CONTINUATION;
+        value >>= 7;
+    }
+    output[size++] = value;
+    return size;
+}
+
+/**
+ * @brief Reads an unsigned LEB128 varint
+ *
+ * @param input encoded value
+ * @param size bytes available in the input
+ * @param value where the value is written
+ * @return uint32_t number of bytes read, zero when the input is truncated or longer than
+ * a 32 bit value
+ */
+uint32_t delta_codec_get_varint(const uint8_t* input, uint32_t size, uint32_t* value) {
+    uint32_t result = 0;
+    for (uint32_t i = 0; i < size && i < DELTA_CODEC_MAX_VARINT_SIZE; i++) {
+        result |= (uint32_t)(input[i] & VARINT_PAYLOAD_MASK) << (7 * i);
+        if ((input[i] & VARINT_CONTINUATION) == 0) {
+            *value = result;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+static uint32_t encode_sample(uint8_t* output, uint16_t* previous, uint16_t sample) {
+    sample &= SAMPLE_MASK;
+    const int32_t delta = (int32_t)sample - *previous;
+    *previous           = sample;
+    // Zig-zag: 0, -1, 1, -2, 2 ... are mapped to 0, 1, 2, 3, 4 ...
+    const uint32_t zigzag = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+    return delta_codec_put_varint(output, zigzag);
+}
@@ -1,107 +1,442 @@
 #include "application/electrical_analyzer.h"
 
+#include "application/acquisition.h"
+#include "application/energy_storage.h"
+#include "application/fixed_math.h"
+#include "application/frequency_analyzer.h"
+#include "application/harmonic_analyzer.h"
+#include "application/oversampler.h"
+#include "application/power_quality.h"
+#include "application/spectrum_analyzer.h"
 #include "application/timer_handler.h"
-#include "stm32f1xx_hal.h"
+#include "application/unit_conversion.h"
+#include "stm32f1xx.h"
+#include "usbd_cdc_if.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+// Phase lag of the current transformer, used until a calibrated value is stored
+#define DEFAULT_PHASE_DELAY_NS 600000
+#define MAX_PHASE_DELAY_NS     1000000
+// Must be a power of two and longer than the phase delay at the highest sample rate
+#define CURRENT_DELAY_LINE_SIZE 128
+#define CURRENT_DELAY_LINE_MASK (CURRENT_DELAY_LINE_SIZE - 1)
+// The delay is rounded up and the interpolation reads one more sample
+_Static_assert((int64_t)ACQUISITION_HIGHEST_SAMPLE_RATE_HZ * MAX_PHASE_DELAY_NS
+                       / 1000000000
+                   + 2 <= CURRENT_DELAY_LINE_SIZE,
+               "The delay line is shorter than the longest phase delay");
+// The delay is applied in steps of 1/256 of a scan
+#define PHASE_DELAY_FRACTION_BITS 8
+#define PHASE_DELAY_FRACTION_ONE  (1 << PHASE_DELAY_FRACTION_BITS)
+#define PHASE_DELAY_FRACTION_MASK (PHASE_DELAY_FRACTION_ONE - 1)
+
+// RMS windows are closed on an integer number of mains cycles, counted by the rising
+// zero crossings of the voltage. The default is the 12 cycles IEC window for 60 Hz
+#define DEFAULT_WINDOW_CYCLES      12
+#define MIN_WINDOW_CYCLES          1
+#define MAX_WINDOW_CYCLES          30
+#define ZERO_CROSSING_HYSTERESIS_V 10
+#define ZERO_CROSSING_HYSTERESIS_BIT                                                     \
+    ADC_mV_TO_BIT(ZERO_CROSSING_HYSTERESIS_V * 1000 / VOLTAGE_GAIN)
+// If no zero crossing is found, for instance without mains voltage, the window is
+// closed after the time the configured cycles would take at this frequency
+#define MIN_MAINS_FREQUENCY_HZ 40
+// Used to estimate the cycle length before the first window is measured
+#define NOMINAL_MAINS_FREQUENCY_HZ 60
+
+#define MAX_TX_SIZE 100
+
+// The sums hold squares and products of offset corrected codes, which are never larger
+// than a whole 12 bit code. The mean square is shifted by 16 bits before its root, which
+// must not overflow for the longest window, at the highest rate and cycles
+#define MAX_WINDOW_SAMPLES                                                               \
+    ((int64_t)ACQUISITION_HIGHEST_SAMPLE_RATE_HZ * MAX_WINDOW_CYCLES                     \
+     / MIN_MAINS_FREQUENCY_HZ)
+_Static_assert(MAX_WINDOW_SAMPLES * 4096 <= INT32_MAX,
+               "Code sums can overflow in the longest window");
+_Static_assert(MAX_WINDOW_SAMPLES * 4096 * 4096 <= INT64_MAX >> 16,
+               "Square sums can overflow in the longest window");
+_Static_assert(MAX_WINDOW_SAMPLES * 4096 * (4096 << PHASE_DELAY_FRACTION_BITS)
+                   <= INT64_MAX,
+               "Power sum can overflow in the longest window");
+
+// The counters are saved at most once in this period, and only if they changed. With
+// the two pages of records, a page is erased once every 16 saves
+#define ENERGY_CHECKPOINT_PERIOD_MS (10 * 60 * 1000)
+#define uJ_PER_mWh                  3600000
+
+// Must be a power of two, so the free running indexes can be wrapped with a mask
+#define WINDOW_QUEUE_SIZE 8
+#define WINDOW_QUEUE_MASK (WINDOW_QUEUE_SIZE - 1)
+
+// The sums are kept in ADC codes with the tracked offset removed, and only scaled to the
+// units once per window by the main loop. What is left of the offset is the mean of the
+// codes, which is removed from the squares and from the power as well
+struct measurement_window {
+    int32_t voltage_sum;
+    int32_t current_sum;
+    int16_t voltage_min;
+    int16_t voltage_max;
+    int16_t current_min;
+    int16_t current_max;
+    int64_t voltage_sum_of_square;
+    int64_t current_sum_of_square;
+    // Sum of the instantaneous power, voltage times the phase aligned current in Q8
+    int64_t power_sum;
+    uint32_t samples;
+    // Complete mains cycles in the window, zero when it was closed by timeout
+    uint32_t cycles;
+    // Rate of the samples, the main loop may take the window after a rate change
+    uint32_t sample_rate;
+};
 
-#include <math.h>
+/**
+ * @brief Gets the transformer phase delay converted to a number of scans at the current
+ * sample rate, with PHASE_DELAY_FRACTION_BITS of fraction
+ *
+ * @return uint32_t delay in fractional scans, limited by the size of the current delay
+ * line
+ */
+static uint32_t get_phase_delay_scans_q8(void);
 
-#define NUM_CHANNELS     4
-#define ADC_BIT_TO_mV(x) (((3300000 / 4095) * x) / 1000)
+/**
+ * @brief Updates the waveform statistics of a channel with a completed window
+ *
+ * @param statistics statistics of the channel, in its units
+ * @param min lowest code of the window, in Q8 with the mean removed
+ * @param max highest code of the window, in Q8 with the mean removed
+ * @param rms_q8 rms of the window in Q8 codes
+ * @param convert conversion of Q8 codes to the units of the channel
+ */
+static void update_statistics(struct waveform_statistics* statistics, int32_t min,
+                              int32_t max, uint32_t rms_q8, int32_t (*convert)(int32_t));
 
-#define ADC_CHANNEL_LUX         0
-#define ADC_CHANNEL_TEMPERATURE 1
-#define ADC_CHANNEL_VOLTAGE     2
-#define ADC_CHANNEL_CURRENT     3
+/**
+ * @brief Converts a signed voltage in Q8 codes to mV
+ *
+ * @param code_q8 voltage in Q8 codes
+ * @return int32_t voltage in mV
+ */
+static int32_t voltage_q8_to_mV(int32_t code_q8);
 
-#define TEMPERATURE_SLOPE     0.025062823967831f
-#define TEMPERATURE_INTERCEPT -25.505305176557748f
-#define LUX_SLOPE             0.911390660003446f
-#define LUX_INTERCEPT         -425.5767706358779f
+/**
+ * @brief Converts a signed current in Q8 codes to uA
+ *
+ * @param code_q8 current in Q8 codes
+ * @return int32_t current in uA
+ */
+static int32_t current_q8_to_uA(int32_t code_q8);
 
-#define SQUARE_ROOT_x1000 1414
+/**
+ * @brief Moves the tracked offsets to the mean of the codes of a completed window, so the
+ * next windows are centered on the actual offset of the analog front end
+ *
+ * @param window completed window
+ */
+static void track_offsets(const struct measurement_window* window);
+
+/**
+ * @brief Publishes a completed window to the main loop. Only called from the DMA
+ * interrupt, which is the single producer of the queue
+ *
+ * @param window completed window
+ */
+static void window_queue_push(const struct measurement_window* window);
 
-// Defines about voltage acquisition
-#define VOLTAGE_REDUCED_MAX_mV 3160
-#define VOLTAGE_REDUCED_MIN_mV 200
-#define VOLTAGE_REAL_MAX_mV    (127 * SQUARE_ROOT_x1000)
+/**
+ * @brief Takes the oldest completed window from the queue. Only called from the main
+ * loop, which is the single consumer of the queue
+ *
+ * @param window where the window is copied to
+ * @return true A window was available
+ * @return false The queue is empty
+ */
+static bool window_queue_pop(struct measurement_window* window);
 
-#define VOLTAGE_REDUCED_OFFSET_mV ((VOLTAGE_REDUCED_MIN_mV + VOLTAGE_REDUCED_MAX_mV) / 2)
-#define VOLTAGE_GAIN                                                                     \
-    (VOLTAGE_REAL_MAX_mV / (VOLTAGE_REDUCED_MAX_mV - VOLTAGE_REDUCED_OFFSET_mV))
+/**
+ * @brief Adds the energy of a completed window to the counters
+ *
+ * @param samples number of samples in the window
+ * @param sample_rate rate of the samples of the window in Hz
+ */
+static void accumulate_energy(uint32_t samples, uint32_t sample_rate);
 
-#define VOLTAGE_BIT_TO_REDUCED_mV(x) (ADC_BIT_TO_mV(x) - VOLTAGE_REDUCED_OFFSET_mV)
-#define VOLTAGE_BIT_TO_REAL_V(x)     (VOLTAGE_GAIN * VOLTAGE_BIT_TO_REDUCED_mV(x) / 1000)
+/**
+ * @brief Executes the energy commands received by the USB, and saves the counters to
+ * the flash when the checkpoint period has elapsed
+ *
+ */
+static void energy_handler(void);
+
+// Single producer single consumer queue of completed windows. The head is only written
+// by the DMA interrupt and the tail only by the main loop, so no lock is needed
+static struct measurement_window window_queue[WINDOW_QUEUE_SIZE];
+static volatile uint32_t window_queue_head;
+static volatile uint32_t window_queue_tail;
+static volatile uint32_t window_queue_overruns;
+
+// Written by the USB interrupt and read by the DMA interrupt, once per block
+static volatile uint32_t window_cycles = DEFAULT_WINDOW_CYCLES;
+
+// The state of the block processing is only used by the DMA interrupt. The reset is
+// requested by other contexts and done before the next block, starting with the first one
+static volatile bool is_reset_requested = true;
+
+// Every window starts from this one, the extremes start from the opposite ends so the
+// first sample replaces them
+static const struct measurement_window empty_window = {
+    .voltage_min = INT16_MAX,
+    .voltage_max = INT16_MIN,
+    .current_min = INT16_MAX,
+    .current_max = INT16_MIN,
+};
+
+// Offsets of the ADC codes, starting from the nominal midpoints of the front end. The
+// codes are taken from the whole offsets, and the fraction is kept for the diagnostics.
+// Only written by the DMA interrupt
+static int32_t voltage_offset             = VOLTAGE_REDUCED_OFFSET_BIT;
+static int32_t current_offset             = CURRENT_REDUCED_OFFSET_BIT;
+static volatile int32_t voltage_offset_q8 = VOLTAGE_REDUCED_OFFSET_BIT << 8;
+static volatile int32_t current_offset_q8 = CURRENT_REDUCED_OFFSET_BIT << 8;
+
+static int32_t voltage_rms;
+static int32_t current_rms;
+static int32_t active_power;
+static int32_t apparent_power;
+static int32_t reactive_power;
+static int32_t power_factor;
+static struct waveform_statistics voltage_statistics;
+static struct waveform_statistics current_statistics;
+static volatile bool is_peak_hold_clear_requested;
+
+// Only changed in the main loop, the commands are forwarded to it through the flags
+static struct energy_counters energy;
+static struct calibration calibration = {.phase_delay_ns = DEFAULT_PHASE_DELAY_NS};
+static bool is_energy_changed;
+static bool is_save_requested;
+static volatile bool is_calibration_changed;
+static uint32_t energy_timer;
+static volatile bool is_energy_show_requested;
+static volatile bool is_energy_reset_requested;
 
-// Defines about current acquisition
-#define CURRENT_REDUCED_MAX_mV   2760
-#define CURRENT_REDUCED_MIN_mV   80
-#define CURRENT_REAL_MAX_uV      (200 * 1000)
-#define CURRENT_REAL_SHUNT_VALUE (3)
+/**
+ * @brief Initialize functions needed for the electrical analyzer such as ADC calibration
+ * and DMA start
+ *
+ */
+void electrical_analyzer_init(void) {
+    energy_storage_load(&energy, &calibration);
+    energy_timer = timer_update_ms();
+    acquisition_init();
+}
 
-#define CURRENT_REDUCED_OFFSET_mV ((CURRENT_REDUCED_MIN_mV + CURRENT_REDUCED_MAX_mV) / 2)
-#define CURRENT_GAIN                                                                     \
-    (CURRENT_REAL_MAX_uV / (CURRENT_REDUCED_MAX_mV - CURRENT_REDUCED_OFFSET_mV))
+/**
+ * @brief This function is like loop() function. It evaluates every window completed
+ * since the last call, from the boot, so the energy is integrated even when nothing is
+ * printed.
+ *
+ */
+void electrical_analyzer_handler(void) {
+    energy_handler();
 
-#define CURRENT_BIT_TO_REDUCED_mV(x) (ADC_BIT_TO_mV(x) - CURRENT_REDUCED_OFFSET_mV)
-#define CURRENT_BIT_TO_REAL_mA(x)                                                        \
-    ((CURRENT_GAIN * CURRENT_BIT_TO_REDUCED_mV(x)) / (CURRENT_REAL_SHUNT_VALUE * 1000))
+    if (is_peak_hold_clear_requested) {
+        is_peak_hold_clear_requested  = false;
+        voltage_statistics.peak_hold = 0;
+        current_statistics.peak_hold = 0;
+    }
 
-#define PHASE_DELAY_US                 600
-#define MINUMUM_SAMPLES_FOR_DATA_READY 10000
+    struct measurement_window window;
+    while (window_queue_pop(&window)) {
+        // The mean of the codes is removed from the sums, the variance is the mean
+        // square minus the square of the mean
+        const int64_t samples = window.samples;
+        const int64_t voltage_square =
+            window.voltage_sum_of_square
+            - (int64_t)window.voltage_sum * window.voltage_sum / samples;
+        const int64_t current_square =
+            window.current_sum_of_square
+            - (int64_t)window.current_sum * window.current_sum / samples;
+        const int64_t power =
+            window.power_sum
+            - (int64_t)window.voltage_sum * window.current_sum / samples
+                  * PHASE_DELAY_FRACTION_ONE;
+
+        // The mean squares are taken in Q16, so the roots have 8 bits of fraction
+        const uint32_t voltage_rms_q8 =
+            fixed_math_isqrt64((voltage_square << 16) / samples);
+        const uint32_t current_rms_q8 =
+            fixed_math_isqrt64((current_square << 16) / samples);
+        voltage_rms = VOLTAGE_BIT_Q8_TO_REAL_mV(voltage_rms_q8);
+        current_rms = CURRENT_BIT_Q8_TO_REAL_uA(current_rms_q8);
+
+        // The codes may be negative, so they are scaled by multiplications, a left shift
+        // of a negative value is undefined
+        const int32_t voltage_mean_q8 = (int64_t)window.voltage_sum * 256 / samples;
+        const int32_t current_mean_q8 = (int64_t)window.current_sum * 256 / samples;
+        update_statistics(&voltage_statistics,
+                          window.voltage_min * 256 - voltage_mean_q8,
+                          window.voltage_max * 256 - voltage_mean_q8, voltage_rms_q8,
+                          voltage_q8_to_mV);
+        update_statistics(&current_statistics,
+                          window.current_min * 256 - current_mean_q8,
+                          window.current_max * 256 - current_mean_q8, current_rms_q8,
+                          current_q8_to_uA);
+
+        active_power   = POWER_BIT2_Q8_TO_REAL_mW(power / samples);
+        apparent_power = (int64_t)voltage_rms * current_rms / 1000000;
+        // The power triangle gives the reactive power magnitude from the other two
+        const int64_t apparent_square = (int64_t)apparent_power * apparent_power;
+        const int64_t active_square   = (int64_t)active_power * active_power;
+        reactive_power = 0;
+        if (apparent_square > active_square) {
+            reactive_power = fixed_math_isqrt64(apparent_square - active_square);
+        }
+        power_factor = apparent_power != 0 ? (active_power * 1000) / apparent_power : 0;
+
+        accumulate_energy(window.samples, window.sample_rate);
+    }
+}
 
-extern ADC_HandleTypeDef hadc1;
-extern DMA_HandleTypeDef hdma_adc1;
+/**
+ * @brief Sends the energy counters. The command is only executed by the main loop, which
+ * owns the counters
+ *
+ */
+void electrical_analyzer_show_energy(void) {
+    is_energy_show_requested = true;
+}
 
-static uint16_t adc_buf[NUM_CHANNELS];
+/**
+ * @brief Clears the energy counters, in the RAM and in the flash. The command is only
+ * executed by the main loop, which owns the counters
+ *
+ */
+void electrical_analyzer_reset_energy(void) {
+    is_energy_reset_requested = true;
+}
 
-static uint32_t voltage_sum_of_square;
-static uint32_t current_sum_of_square;
-static int32_t samples;
-static bool data_ready;
+/**
+ * @brief Clears the peak hold of both channels. The command is only executed by the main
+ * loop, which owns the statistics
+ *
+ */
+void electrical_analyzer_clear_peak_hold(void) {
+    is_peak_hold_clear_requested = true;
+}
 
-static int16_t voltage_rms;
-static int16_t current_rms;
-static bool is_rms_acquisition_activated = false;
+/**
+ * @brief Gets how many completed windows were discarded because the main loop did not
+ * drain the queue in time
+ *
+ * @return uint32_t number of discarded windows
+ */
+uint32_t get_window_overruns(void) {
+    return window_queue_overruns;
+}
 
 /**
- * @brief Initialize functions needed for the electrical analyzer such as ADC calibration
- * and DMA start
+ * @brief Discards the window in progress and the zero crossing tracking, for instance
+ * when the sample rate changes and the samples counted so far mean another duration
  *
  */
-void electrical_analyzer_init(void) {
-    // All STM32F1 devices allow self calibration. It should be done after every power-up
-    HAL_ADCEx_Calibration_Start(&hadc1);
-    // Start to directly transfer ADC results to memory. This means that everytime the ADC
-    // conversion is done in every channel the adc_buf vector is updated automatically
-    // with no time lost by the ARM core.
-    HAL_ADC_Start_DMA(&hadc1, (uint32_t*)adc_buf, NUM_CHANNELS);
+void electrical_analyzer_reset(void) {
+    is_reset_requested = true;
+    frequency_analyzer_reset();
+    power_quality_reset();
 }
 
 /**
- * @brief This function is like loop() function. It only runs if rms acquisition is
- * activated and there is data ready.
+ * @brief Updates the number of mains cycles in every RMS window
  *
+ * @param value new number of cycles, limited by MIN_WINDOW_CYCLES and MAX_WINDOW_CYCLES
  */
-void electrical_analyzer_handler(void) {
-    if (!is_rms_acquisition_activated) {
+void electrical_analyzer_update_window_cycles(int32_t value) {
+    char string_to_send[MAX_TX_SIZE];
+    int32_t tam;
+
+    if (value >= MIN_WINDOW_CYCLES && value <= MAX_WINDOW_CYCLES) {
+        window_cycles = value;
+        // The window in progress was started with the previous number of cycles
+        electrical_analyzer_reset();
+
+        tam = sprintf(string_to_send, "RMS window set as %" PRIu32 " cycles.\n",
+                      window_cycles);
+    } else {
+        tam = sprintf(string_to_send,
+                      "Value not allowed, allowed windows are %d to %d cycles.\n",
+                      MIN_WINDOW_CYCLES, MAX_WINDOW_CYCLES);
+    }
+
+    if (tam > MAX_TX_SIZE) {
         return;
     }
-    if (!data_ready) {
+    CDC_Transmit_FS((uint8_t*)string_to_send, tam);
+}
+
+/**
+ * @brief Updates the delay applied to the current to compensate the phase lag of the
+ * transformer. It is stored in the flash with the energy counters by the main loop
+ *
+ * @param value new delay in ns, limited by MAX_PHASE_DELAY_NS
+ */
+void electrical_analyzer_update_phase_delay(int32_t value) {
+    char string_to_send[MAX_TX_SIZE];
+    int32_t tam;
+
+    if (value >= 0 && value <= MAX_PHASE_DELAY_NS) {
+        calibration.phase_delay_ns = value;
+        is_calibration_changed     = true;
+
+        tam = sprintf(string_to_send,
+                      "Phase delay set as %" PRId32 " ns, %" PRIu32 "/256 scans.\n",
+                      calibration.phase_delay_ns, get_phase_delay_scans_q8());
+    } else {
+        tam = sprintf(string_to_send,
+                      "Value not allowed, allowed phase delays are 0 to %d ns.\n",
+                      MAX_PHASE_DELAY_NS);
+    }
+
+    if (tam > MAX_TX_SIZE) {
         return;
     }
+    CDC_Transmit_FS((uint8_t*)string_to_send, tam);
+}
 
-    voltage_rms = sqrt(voltage_sum_of_square / samples);
-    current_rms = sqrt(current_sum_of_square / samples);
-    data_ready  = false;
+/**
+ * @brief Get the rms value of a voltage harmonic measured in the last window
+ *
+ * @param harmonic harmonic order, 1 for the fundamental
+ * @return int32_t voltage in mV RMS
+ */
+int32_t get_voltage_harmonic(uint8_t harmonic) {
+    return VOLTAGE_BIT_Q8_TO_REAL_mV(harmonic_analyzer_get_voltage(harmonic));
 }
 
 /**
- * @brief Allows other files to set the if rms acquisition is activated
+ * @brief Get the rms value of a current harmonic measured in the last window
  *
- * @param status
+ * @param harmonic harmonic order, 1 for the fundamental
+ * @return int32_t current in uA RMS
  */
-void set_is_rms_acquisition_activated(bool status) {
-    is_rms_acquisition_activated = status;
+int32_t get_current_harmonic(uint8_t harmonic) {
+    return CURRENT_BIT_Q8_TO_REAL_uA(harmonic_analyzer_get_current(harmonic));
+}
+
+/**
+ * @brief Get the rms value of one bin of the last spectrum
+ *
+ * @param bin frequency bin
+ * @return int32_t voltage in mV RMS or current in uA RMS, depending on the channel of the
+ * spectrum
+ */
+int32_t get_spectrum_magnitude(uint32_t bin) {
+    const uint32_t value_q8 = spectrum_analyzer_get_magnitude(bin);
+    if (spectrum_analyzer_get_channel() == spectrum_analyzer_voltage) {
+        return VOLTAGE_BIT_Q8_TO_REAL_mV(value_q8);
+    }
+    return CURRENT_BIT_Q8_TO_REAL_uA(value_q8);
 }
 
 /**
@@ -110,7 +445,8 @@ void set_is_rms_acquisition_activated(bool status) {
  * @return int32_t Voltage in V
  */
 int32_t get_instant_voltage(void) {
-    return VOLTAGE_BIT_TO_REAL_V(adc_buf[ADC_CHANNEL_VOLTAGE]);
+    const uint16_t* scan = acquisition_get_latest_scan();
+    return unit_conversion_voltage_V[scan[ACQUISITION_RANK_VOLTAGE]];
 }
 
 /**
@@ -119,53 +455,91 @@ int32_t get_instant_voltage(void) {
  * @return int32_t current in mA
  */
 int32_t get_instant_current(void) {
-    return CURRENT_BIT_TO_REAL_mA(adc_buf[ADC_CHANNEL_CURRENT]);
+    const uint16_t* scan = acquisition_get_latest_scan();
+    return unit_conversion_current_mA[scan[ACQUISITION_RANK_CURRENT]];
 }
 
 /**
- * @brief Get the lux value from the ADC converted to lux level
+ * @brief Get the lux value from the oversampled ADC output converted to lux level
  *
- * @return float value in lx
+ * @return int32_t value in tenths of lx
  */
-float get_lux(void) {
-    const uint16_t lux_value = adc_buf[ADC_CHANNEL_LUX] - 150;
-    if (lux_value < 470) {
-        return 0;
-    }
-    return ((float)(lux_value)*LUX_SLOPE) + LUX_INTERCEPT;
+int32_t get_lux(void) {
+    return unit_conversion_lux(oversampler_get(oversampler_lux));
 }
 
 /**
- * @brief Get the temperature value from the ADC converted to temperature
+ * @brief Get the temperature value from the oversampled ADC output converted to
+ * temperature
  *
- * @return float value in celsius
+ * @return int32_t value in hundredths of celsius
  */
-float get_temperature(void) {
-    return ((float)(adc_buf[ADC_CHANNEL_TEMPERATURE]) * TEMPERATURE_SLOPE)
-           + TEMPERATURE_INTERCEPT;
+int32_t get_temperature(void) {
+    return unit_conversion_temperature(oversampler_get(oversampler_temperature));
 }
 
 /**
  * @brief Get the instant power value from the voltage and current value multiplied. Since
- * there is a phase lag because of the transformer we wait some time to allow to get the
- * data from both signals at the same moment
+ * there is a phase lag because of the transformer, the current is taken from the scan
+ * acquired closest to the phase delay before the latest one, so both signals are aligned
+ * without waiting
  *
  * @return int32_t power in mW
  */
 int32_t get_instant_power(void) {
-    const int16_t first_value = get_instant_current();
-    const uint32_t delay_us   = timer_update_us();
-    while (!timer_wait_us(delay_us, PHASE_DELAY_US)) {
-        ;
-    }
-    const int16_t second_value = get_instant_voltage();
-    return first_value * second_value;
+    const uint32_t delay_scans =
+        (get_phase_delay_scans_q8() + (1 << (PHASE_DELAY_FRACTION_BITS - 1)))
+        >> PHASE_DELAY_FRACTION_BITS;
+    const uint16_t* current_scan = acquisition_get_previous_scan(delay_scans);
+    const uint16_t* voltage_scan = acquisition_get_latest_scan();
+
+    const int16_t current_value =
+        unit_conversion_current_mA[current_scan[ACQUISITION_RANK_CURRENT]];
+    const int16_t voltage_value =
+        unit_conversion_voltage_V[voltage_scan[ACQUISITION_RANK_VOLTAGE]];
+    return current_value * voltage_value;
+}
+
+/**
+ * @brief Get the offset of the voltage channel tracked by the last windows
+ *
+ * @return int32_t offset at the ADC input in uV
+ */
+int32_t get_voltage_offset(void) {
+    return ((int64_t)voltage_offset_q8 * 3300000) / (4095 * 256);
+}
+
+/**
+ * @brief Get the offset of the current channel tracked by the last windows
+ *
+ * @return int32_t offset at the ADC input in uV
+ */
+int32_t get_current_offset(void) {
+    return ((int64_t)current_offset_q8 * 3300000) / (4095 * 256);
+}
+
+/**
+ * @brief Get the waveform statistics of the voltage in the last window
+ *
+ * @return const struct waveform_statistics* statistics in mV
+ */
+const struct waveform_statistics* get_voltage_statistics(void) {
+    return &voltage_statistics;
+}
+
+/**
+ * @brief Get the waveform statistics of the current in the last window
+ *
+ * @return const struct waveform_statistics* statistics in uA
+ */
+const struct waveform_statistics* get_current_statistics(void) {
+    return &current_statistics;
 }
 
 /**
  * @brief Get the voltage rms
  *
- * @return int32_t voltage in V RMS
+ * @return int32_t voltage in mV RMS
  */
 int32_t get_voltage_rms(void) {
     return voltage_rms;
@@ -174,60 +548,329 @@ int32_t get_voltage_rms(void) {
 /**
  * @brief Get the current rms
  *
- * @return int32_t current in mA RMS
+ * @return int32_t current in uA RMS
  */
 int32_t get_current_rms(void) {
     return current_rms;
 }
 
 /**
- * @brief Get the power rms
+ * @brief Get the active power, the mean of the instantaneous power over the last window
  *
- * @return int32_t power in mW RMS
+ * @return int32_t power in mW
  */
-int32_t get_power_rms(void) {
-    return voltage_rms * current_rms;
+int32_t get_active_power(void) {
+    return active_power;
 }
 
 /**
- * @brief This callback is called every time there is a completed ADC conversion in all
- * channels. It sums the voltage and current squared value obtained by converting the ADC
- * value. After a defined number of samples has been acquired we consider the data ready
- * to be evaluated. This logic will only run when rms acquisition is activated and no
- * data is ready.
+ * @brief Get the apparent power, the product of voltage and current rms
  *
- * @param hadc adc instance
+ * @return int32_t power in mVA
  */
-void HAL_ADC_ConvCpltCallback(ADC_HandleTypeDef* hadc) {
-    static int32_t tmp_current_sum_of_square;
-    static int32_t tmp_voltage_sum_of_square;
-    static int32_t tmp_samples;
+int32_t get_apparent_power(void) {
+    return apparent_power;
+}
 
-    if (hadc != &hadc1) {
-        return;
+/**
+ * @brief Get the magnitude of the reactive power
+ *
+ * @return int32_t power in mvar
+ */
+int32_t get_reactive_power(void) {
+    return reactive_power;
+}
+
+/**
+ * @brief Get the power factor, the ratio between active and apparent power
+ *
+ * @return int32_t power factor multiplied by 1000
+ */
+int32_t get_power_factor(void) {
+    return power_factor;
+}
+
+/**
+ * @brief Processes a block of scans filled by the DMA. It sums the voltage and current
+ * squared value obtained by converting the ADC value of every scan. Windows start and
+ * end at rising zero crossings of the voltage, so they always hold an integer number of
+ * mains cycles. A completed window is published to the main loop and a new one starts
+ * right away, so no sample is lost while the main loop evaluates it. It runs from the
+ * boot, so the energy is integrated even when nothing is shown.
+ *
+ * @param block pointer to the first scan of the block
+ * @param scans number of scans in the block
+ */
+void electrical_analyzer_process_block(const uint16_t* block, uint32_t scans) {
+    static struct measurement_window window;
+    static bool synchronized;
+    static bool crossing_armed;
+    static bool falling_crossing_armed;
+    static int16_t current_delay_line[CURRENT_DELAY_LINE_SIZE];
+    static uint32_t current_delay_index;
+    static uint32_t samples_per_cycle_q16;
+    // Index of the sample being processed, the time reference of the zero crossings
+    static uint64_t sample_index;
+    static int32_t previous_voltage_code;
+
+    if (is_reset_requested) {
+        is_reset_requested     = false;
+        window                 = empty_window;
+        synchronized           = false;
+        crossing_armed         = false;
+        falling_crossing_armed = false;
+        sample_index           = 0;
+        previous_voltage_code  = 0;
+        samples_per_cycle_q16  =
+            ((uint64_t)acquisition_get_sample_rate() << 16) / NOMINAL_MAINS_FREQUENCY_HZ;
+        // The delayed samples were taken at the previous rate, so the phase delay would
+        // not align them with the voltage
+        current_delay_index = 0;
+        for (uint32_t i = 0; i < CURRENT_DELAY_LINE_SIZE; i++) {
+            current_delay_line[i] = 0;
+        }
     }
 
-    if (!is_rms_acquisition_activated) {
+    // The whole block uses the same window length, even if it is updated meanwhile
+    const uint32_t cycles = window_cycles;
+
+    const uint32_t max_samples =
+        acquisition_get_sample_rate() * cycles / MIN_MAINS_FREQUENCY_HZ;
+    const uint32_t delay_q8      = get_phase_delay_scans_q8();
+    const uint32_t delay_scans   = delay_q8 >> PHASE_DELAY_FRACTION_BITS;
+    const int32_t delay_fraction = delay_q8 & PHASE_DELAY_FRACTION_MASK;
+
+    const uint32_t scan_size = acquisition_get_scan_size();
+    for (uint32_t i = 0; i < scans; i++, block += scan_size) {
+        const int32_t voltage_code = block[ACQUISITION_RANK_VOLTAGE] - voltage_offset;
+        const int32_t current_code = block[ACQUISITION_RANK_CURRENT] - current_offset;
+
+        // The crossing is only armed after the voltage goes below the hysteresis, so
+        // noise around zero does not count as extra cycles
+        if (voltage_code < -ZERO_CROSSING_HYSTERESIS_BIT) {
+            crossing_armed = true;
+        } else if (crossing_armed && voltage_code >= 0) {
+            crossing_armed = false;
+            power_quality_finish_half_cycle();
+
+            // The previous sample is still negative, so the crossing is between both
+            // samples and its position is found by linear interpolation
+            const uint32_t fraction_q16 =
+                ((uint32_t)-previous_voltage_code << 16)
+                / (voltage_code - previous_voltage_code);
+            frequency_analyzer_add_crossing(((sample_index - 1) << 16) + fraction_q16);
+
+            if (!synchronized) {
+                // Samples before the first crossing do not belong to a complete cycle
+                synchronized = true;
+                window       = empty_window;
+                harmonic_analyzer_start_window(samples_per_cycle_q16, cycles);
+            } else if (++window.cycles >= cycles) {
+                samples_per_cycle_q16 = ((uint64_t)window.samples << 16) / window.cycles;
+                harmonic_analyzer_finish_window(window.samples);
+                window_queue_push(&window);
+                track_offsets(&window);
+                window = empty_window;
+                harmonic_analyzer_start_window(samples_per_cycle_q16, cycles);
+            }
+        }
+        // The falling crossings only close the half cycles of the power quality
+        if (voltage_code > ZERO_CROSSING_HYSTERESIS_BIT) {
+            falling_crossing_armed = true;
+        } else if (falling_crossing_armed && voltage_code < 0) {
+            falling_crossing_armed = false;
+            power_quality_finish_half_cycle();
+        }
+        if (synchronized) {
+            harmonic_analyzer_update(voltage_code, current_code);
+        }
+        power_quality_update(voltage_code);
+        previous_voltage_code = voltage_code;
+        sample_index++;
+
+        // The current is delayed by the transformer phase lag before being multiplied,
+        // so the instantaneous power uses samples of the same instant. The fraction of
+        // the delay is a linear interpolation between the two nearest samples, a first
+        // order fractional delay filter. Its fraction is kept in the result
+        const uint32_t delayed_index = current_delay_index - delay_scans;
+        current_delay_line[current_delay_index++ & CURRENT_DELAY_LINE_MASK] =
+            current_code;
+        const int32_t newer = current_delay_line[delayed_index & CURRENT_DELAY_LINE_MASK];
+        const int32_t older =
+            current_delay_line[(delayed_index - 1) & CURRENT_DELAY_LINE_MASK];
+        const int32_t aligned_current_q8 =
+            newer * PHASE_DELAY_FRACTION_ONE + (older - newer) * delay_fraction;
+
+        // Each sum is a single 64 bit multiply accumulate instruction
+        window.voltage_sum += voltage_code;
+        window.current_sum += current_code;
+        // Conditional moves, no branches in the sample loop
+        window.voltage_min = voltage_code < window.voltage_min ? voltage_code
+                                                               : window.voltage_min;
+        window.voltage_max = voltage_code > window.voltage_max ? voltage_code
+                                                               : window.voltage_max;
+        window.current_min = current_code < window.current_min ? current_code
+                                                               : window.current_min;
+        window.current_max = current_code > window.current_max ? current_code
+                                                               : window.current_max;
+        window.current_sum_of_square += (int64_t)current_code * current_code;
+        window.voltage_sum_of_square += (int64_t)voltage_code * voltage_code;
+        window.power_sum += (int64_t)voltage_code * aligned_current_q8;
+        window.samples++;
+
+        if (window.samples >= max_samples) {
+            window.cycles = 0;
+            window_queue_push(&window);
+            track_offsets(&window);
+            window       = empty_window;
+            synchronized = false;
+            frequency_analyzer_reset();
+        }
+    }
+}
+
+static void accumulate_energy(uint32_t samples, uint32_t sample_rate) {
+    // Energy of the window in uJ, power in mW times the window duration in ms
+    const int64_t duration = (int64_t)samples * 1000;
+    const int64_t active   = (int64_t)active_power * duration / sample_rate;
+    const int64_t reactive = (int64_t)reactive_power * duration / sample_rate;
+    const int64_t apparent = (int64_t)apparent_power * duration / sample_rate;
+
+    if (active == 0 && reactive == 0 && apparent == 0) {
         return;
     }
+    energy.active_uJ += active;
+    energy.reactive_uJ += reactive;
+    energy.apparent_uJ += apparent;
+    is_energy_changed = true;
+}
 
-    if (data_ready) {
+static void energy_handler(void) {
+    if (is_energy_reset_requested) {
+        is_energy_reset_requested = false;
+        energy                    = (struct energy_counters){0};
+        is_save_requested         = true;
+    }
+
+    // The calibration is saved right away, it only changes by command
+    if (is_calibration_changed) {
+        is_calibration_changed = false;
+        is_save_requested      = true;
+    }
+
+    if (is_energy_show_requested) {
+        is_energy_show_requested = false;
+
+        char string_to_send[MAX_TX_SIZE];
+        const int32_t tam =
+            sprintf(string_to_send,
+                    "Energy: %" PRId32 " mWh, %" PRId32 " mvarh, %" PRId32 " mVAh.\n",
+                    (int32_t)(energy.active_uJ / uJ_PER_mWh),
+                    (int32_t)(energy.reactive_uJ / uJ_PER_mWh),
+                    (int32_t)(energy.apparent_uJ / uJ_PER_mWh));
+        if (tam <= MAX_TX_SIZE) {
+            CDC_Transmit_FS((uint8_t*)string_to_send, tam);
+        }
+    }
+
+    if (is_energy_changed && timer_wait_ms(energy_timer, ENERGY_CHECKPOINT_PERIOD_MS)) {
+        is_save_requested = true;
+    }
+    if (!is_save_requested) {
         return;
     }
+    is_save_requested = false;
+    is_energy_changed = false;
+    energy_timer      = timer_update_ms();
+
+    // Every fetch from the flash waits while a page is erased or a record is programmed,
+    // the DMA interrupt included, so the blocks filled meanwhile would be overwritten
+    // before being processed. The acquisition is paused instead, and the window in
+    // progress is discarded when it starts again. A spare page left by a failed erase
+    // is erased before the record, and the page after a new one right after it, so the
+    // next save finds it ready
+    acquisition_pause();
+    energy_storage_erase_spare();
+    energy_storage_save(&energy, &calibration);
+    energy_storage_erase_spare();
+    acquisition_resume();
+}
 
-    const uint32_t current_value_mA = get_instant_current();
-    tmp_current_sum_of_square += current_value_mA * current_value_mA;
-    const uint32_t voltage_value_mV = get_instant_voltage();
-    tmp_voltage_sum_of_square += voltage_value_mV * voltage_value_mV;
-    tmp_samples++;
+static uint32_t get_phase_delay_scans_q8(void) {
+    const uint64_t delay_ns_hz = (uint64_t)calibration.phase_delay_ns
+                                 * acquisition_get_sample_rate()
+                                 << PHASE_DELAY_FRACTION_BITS;
+    const uint32_t delay_q8    = (delay_ns_hz + 500000000) / 1000000000;
+    // The interpolation also reads the sample after the integer delay
+    const uint32_t max_q8 = (CURRENT_DELAY_LINE_SIZE - 2) << PHASE_DELAY_FRACTION_BITS;
+    if (delay_q8 > max_q8) {
+        return max_q8;
+    }
+    return delay_q8;
+}
+
+static void update_statistics(struct waveform_statistics* statistics, int32_t min,
+                              int32_t max, uint32_t rms_q8, int32_t (*convert)(int32_t)) {
+    const int32_t peak_q8 = max > -min ? max : -min;
+
+    statistics->min          = convert(min);
+    statistics->max          = convert(max);
+    statistics->peak_to_peak = convert(max - min);
+    statistics->crest_factor = rms_q8 != 0 ? ((int64_t)peak_q8 * 1000) / rms_q8 : 0;
+
+    const int32_t peak = convert(peak_q8);
+    if (peak > statistics->peak_hold) {
+        statistics->peak_hold = peak;
+    }
+}
+
+static int32_t voltage_q8_to_mV(int32_t code_q8) {
+    if (code_q8 < 0) {
+        return -(int32_t)VOLTAGE_BIT_Q8_TO_REAL_mV(-code_q8);
+    }
+    return VOLTAGE_BIT_Q8_TO_REAL_mV(code_q8);
+}
+
+static int32_t current_q8_to_uA(int32_t code_q8) {
+    if (code_q8 < 0) {
+        return -(int32_t)CURRENT_BIT_Q8_TO_REAL_uA(-code_q8);
+    }
+    return CURRENT_BIT_Q8_TO_REAL_uA(code_q8);
+}
+
+static void track_offsets(const struct measurement_window* window) {
+    const int64_t samples = window->samples;
+    // The mean of the codes is what is left of the offset used in the window
+    voltage_offset_q8 =
+        voltage_offset * 256 + (int64_t)window->voltage_sum * 256 / samples;
+    current_offset_q8 =
+        current_offset * 256 + (int64_t)window->current_sum * 256 / samples;
+    voltage_offset = (voltage_offset_q8 + 128) >> 8;
+    current_offset = (current_offset_q8 + 128) >> 8;
+}
+
+static void window_queue_push(const struct measurement_window* window) {
+    const uint32_t head = window_queue_head;
+    if (head - window_queue_tail >= WINDOW_QUEUE_SIZE) {
+        window_queue_overruns++;
+        return;
+    }
+    window_queue[head & WINDOW_QUEUE_MASK]             = *window;
+    window_queue[head & WINDOW_QUEUE_MASK].sample_rate = acquisition_get_sample_rate();
+    // The window must be completely written before the consumer can see the new head
+    __DMB();
+    window_queue_head = head + 1;
+}
 
-    if (tmp_samples > MINUMUM_SAMPLES_FOR_DATA_READY) {
-        data_ready                = true;
-        current_sum_of_square     = tmp_current_sum_of_square;
-        voltage_sum_of_square     = tmp_voltage_sum_of_square;
-        samples                   = tmp_samples;
-        tmp_current_sum_of_square = 0;
-        tmp_voltage_sum_of_square = 0;
-        tmp_samples               = 0;
+static bool window_queue_pop(struct measurement_window* window) {
+    const uint32_t tail = window_queue_tail;
+    if (tail == window_queue_head) {
+        return false;
     }
+    // The head has been read before the window, which was written before the head
+    __DMB();
+    *window = window_queue[tail & WINDOW_QUEUE_MASK];
+    __DMB();
+    window_queue_tail = tail + 1;
+    return true;
 }
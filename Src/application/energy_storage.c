@@ -0,0 +1,242 @@
+/**
+ * @file energy_storage.c
+ * @brief Keeps the energy counters and the calibration in the flash pages reserved by
+ * the linker script, so they survive resets. Every checkpoint is appended as a new
+ * record. The page after the one being filled is erased in advance, so a save never
+ * waits for an erase
+ *
+ */
+
+#include "application/energy_storage.h"
+
+#include "stm32f1xx_hal.h"
+
+#include <string.h>
+
+#define RECORD_WORDS     (sizeof(struct energy_record) / sizeof(uint32_t))
+#define RECORDS_PER_PAGE (FLASH_PAGE_SIZE / sizeof(struct energy_record))
+#define ERASED_WORD      0xFFFFFFFF
+
+struct energy_record {
+    struct energy_counters counters;
+    struct calibration calibration;
+    // Pads the record to a size that divides the page, room for new calibration values
+    uint32_t reserved[7];
+    uint32_t sequence;
+    uint32_t checksum;
+};
+
+_Static_assert(FLASH_PAGE_SIZE % sizeof(struct energy_record) == 0,
+               "Records must not cross the page boundaries");
+
+/**
+ * @brief Computes the checksum of a record. It never matches an erased record
+ *
+ * @param record record to be checked
+ * @return uint32_t complement of the sum of every word before the checksum
+ */
+static uint32_t compute_checksum(const struct energy_record* record);
+
+/**
+ * @brief Checks if a record slot is still erased and can be programmed
+ *
+ * @param record record slot in the flash
+ * @return true if every word of the slot is erased
+ */
+static bool is_erased(const struct energy_record* record);
+
+/**
+ * @brief Checks if every record slot of a page is erased
+ *
+ * @param slot first record slot of the page
+ * @return true if the whole page is erased
+ */
+static bool is_page_erased(uint32_t slot);
+
+/**
+ * @brief Finds the page which receives the records after the current one and checks if
+ * it is already erased
+ *
+ */
+static void update_spare_page(void);
+
+// Defined by the linker script
+extern uint32_t _senergy[];
+extern uint32_t _eenergy[];
+
+static uint32_t next_slot;
+static uint32_t sequence;
+// First slot of the page erased in advance, which never holds the latest record
+static uint32_t spare_slot;
+static bool is_spare_erased;
+
+/**
+ * @brief Reads the most recent valid record from the flash
+ *
+ * @param counters where the stored counters are written, cleared when there is no record
+ * @param calibration where the stored calibration is written, untouched when there is
+ * no record so the defaults are kept
+ * @return true if a valid record was found
+ */
+bool energy_storage_load(struct energy_counters* counters,
+                         struct calibration* calibration) {
+    const struct energy_record* records = (const struct energy_record*)_senergy;
+    const uint32_t slots                = (_eenergy - _senergy) / RECORD_WORDS;
+    bool found                          = false;
+
+    *counters = (struct energy_counters){0};
+    next_slot = 0;
+    sequence  = 0;
+
+    for (uint32_t slot = 0; slot < slots; slot++) {
+        const struct energy_record* record = &records[slot];
+        if (record->checksum != compute_checksum(record)) {
+            continue;
+        }
+        if (!found || record->sequence > sequence) {
+            found     = true;
+            sequence  = record->sequence;
+            *counters    = record->counters;
+            *calibration = record->calibration;
+            next_slot = (slot + 1) % slots;
+        }
+    }
+    update_spare_page();
+    return found;
+}
+
+/**
+ * @brief Checks if the next record can be written right away. It cannot while the page
+ * it goes to is waiting to be erased by energy_storage_erase_spare
+ *
+ * @return true if energy_storage_save can write the record
+ */
+bool energy_storage_is_ready(void) {
+    const struct energy_record* records = (const struct energy_record*)_senergy;
+    const uint32_t slots                = (_eenergy - _senergy) / RECORD_WORDS;
+
+    // A slot left programmed by a write interrupted by a reset cannot be used, so the
+    // records move on to the next page
+    if (next_slot % RECORDS_PER_PAGE != 0 && !is_erased(&records[next_slot])) {
+        next_slot = (next_slot / RECORDS_PER_PAGE + 1) * RECORDS_PER_PAGE % slots;
+        update_spare_page();
+    }
+    return next_slot != spare_slot || is_spare_erased;
+}
+
+/**
+ * @brief Appends a record with the counters and the calibration to the flash. Nothing is
+ * erased here. Programming the record stalls the flash fetches for about 2 ms, so the
+ * acquisition must be paused around it
+ *
+ * @param counters counters to be stored
+ * @param calibration calibration to be stored
+ * @return true if the record was written and read back correctly, false as well when
+ * energy_storage_is_ready is false
+ */
+bool energy_storage_save(const struct energy_counters* counters,
+                         const struct calibration* calibration) {
+    const struct energy_record* records = (const struct energy_record*)_senergy;
+    const uint32_t slots                = (_eenergy - _senergy) / RECORD_WORDS;
+
+    if (!energy_storage_is_ready()) {
+        return false;
+    }
+
+    struct energy_record record = {
+        .counters    = *counters,
+        .calibration = *calibration,
+        .sequence    = sequence + 1,
+    };
+    record.checksum = compute_checksum(&record);
+
+    const uint32_t* words  = (const uint32_t*)&record;
+    const uint32_t address = (uint32_t)&records[next_slot];
+
+    HAL_FLASH_Unlock();
+    for (uint32_t i = 0; i < RECORD_WORDS; i++) {
+        if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, address + 4 * i, words[i])
+            != HAL_OK) {
+            break;
+        }
+    }
+    HAL_FLASH_Lock();
+
+    const bool written = memcmp(&records[next_slot], &record, sizeof(record)) == 0;
+    sequence           = record.sequence;
+    next_slot          = (next_slot + 1) % slots;
+    // Once the first record of a page is written, the records of the next page are all
+    // older and it becomes the spare page
+    update_spare_page();
+    return written;
+}
+
+/**
+ * @brief Erases the spare page if it is not erased yet. A page erase takes 20 to 40 ms,
+ * and every fetch from the flash waits for it, interrupts included, so the acquisition
+ * must be paused around it. It only has work once every 16 saves
+ *
+ * @return true if the spare page is erased
+ */
+bool energy_storage_erase_spare(void) {
+    if (is_spare_erased) {
+        return true;
+    }
+
+    FLASH_EraseInitTypeDef erase = {
+        .TypeErase   = FLASH_TYPEERASE_PAGES,
+        .PageAddress = (uint32_t)((const struct energy_record*)_senergy + spare_slot),
+        .NbPages     = 1,
+    };
+    uint32_t page_error;
+    HAL_FLASH_Unlock();
+    const HAL_StatusTypeDef status = HAL_FLASHEx_Erase(&erase, &page_error);
+    HAL_FLASH_Lock();
+
+    // A failed erase is done again before the next save
+    is_spare_erased = status == HAL_OK && is_page_erased(spare_slot);
+    return is_spare_erased;
+}
+
+static uint32_t compute_checksum(const struct energy_record* record) {
+    const uint32_t* words = (const uint32_t*)record;
+    uint32_t sum          = 0;
+    for (uint32_t i = 0; i < RECORD_WORDS - 1; i++) {
+        sum += words[i];
+    }
+    return ~sum;
+}
+
+static bool is_erased(const struct energy_record* record) {
+    const uint32_t* words = (const uint32_t*)record;
+    for (uint32_t i = 0; i < RECORD_WORDS; i++) {
+        if (words[i] != ERASED_WORD) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void update_spare_page(void) {
+    const uint32_t slots                = (_eenergy - _senergy) / RECORD_WORDS;
+
+    // The page of the next slot when it starts a page, so the latest record is at the
+    // end of the previous one, or else the page after it
+    const uint32_t slot =
+        (next_slot + RECORDS_PER_PAGE - 1) / RECORDS_PER_PAGE * RECORDS_PER_PAGE % slots;
+    if (slot == spare_slot && is_spare_erased) {
+        return;
+    }
+    spare_slot      = slot;
+    is_spare_erased = is_page_erased(slot);
+}
+
+static bool is_page_erased(uint32_t slot) {
+    const struct energy_record* records = (const struct energy_record*)_senergy;
+    for (uint32_t i = 0; i < RECORDS_PER_PAGE; i++) {
+        if (!is_erased(&records[slot + i])) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,207 @@
+/**
+ * @file fft.c
+ * @brief In place radix-4 fast Fourier transform in Q15, with the twiddle factors in a
+ * table in flash
+ *
+ */
+
+#include "application/fft.h"
+
+/**
+ * @brief Radix-4 decimation in frequency butterfly. The outputs are divided by 4 and
+ * multiplied by the twiddle factors of the next stage
+ *
+ * @param data interleaved complex data
+ * @param index position of the first input
+ * @param quarter distance between the inputs
+ * @param twiddle angle of the first twiddle factor, in table units
+ */
+static void butterfly_radix4(int16_t* data, uint32_t index, uint32_t quarter,
+                             uint32_t twiddle);
+
+/**
+ * @brief Multiplies a complex value by the twiddle factor exp(-j * angle) and stores it
+ *
+ * @param data where the result is stored, real part first
+ * @param real real part of the value
+ * @param imaginary imaginary part of the value
+ * @param twiddle angle in table units
+ */
+static void store_rotated(int16_t* data, int32_t real, int32_t imaginary,
+                          uint32_t twiddle);
+
+// sin(2 * pi * i / FFT_MAX_POINTS) in Q15, the cosine is read a quarter turn ahead
+static const int16_t sin_table[FFT_MAX_POINTS] = {
+    0, 402, 804, 1206, 1608, 2009, 2410, 2811, 3212, 3612,
+    4011, 4410, 4808, 5205, 5602, 5998, 6393, 6786, 7179, 7571,
+    7962, 8351, 8739, 9126, 9512, 9896, 10278, 10659, 11039, 11417,
+    11793, 12167, 12539, 12910, 13279, 13645, 14010, 14372, 14732, 15090,
+    15446, 15800, 16151, 16499, 16846, 17189, 17530, 17869, 18204, 18537,
+    18868, 19195, 19519, 19841, 20159, 20475, 20787, 21096, 21403, 21705,
+    22005, 22301, 22594, 22884, 23170, 23452, 23731, 24007, 24279, 24547,
+    24811, 25072, 25329, 25582, 25832, 26077, 26319, 26556, 26790, 27019,
+    27245, 27466, 27683, 27896, 28105, 28310, 28510, 28706, 28898, 29085,
+    29268, 29447, 29621, 29791, 29956, 30117, 30273, 30424, 30571, 30714,
+    30852, 30985, 31113, 31237, 31356, 31470, 31580, 31685, 31785, 31880,
+    31971, 32057, 32137, 32213, 32285, 32351, 32412, 32469, 32521, 32567,
+    32609, 32646, 32678, 32705, 32728, 32745, 32757, 32765, 32767, 32765,
+    32757, 32745, 32728, 32705, 32678, 32646, 32609, 32567, 32521, 32469,
+    32412, 32351, 32285, 32213, 32137, 32057, 31971, 31880, 31785, 31685,
+    31580, 31470, 31356, 31237, 31113, 30985, 30852, 30714, 30571, 30424,
+    30273, 30117, 29956, 29791, 29621, 29447, 29268, 29085, 28898, 28706,
+    28510, 28310, 28105, 27896, 27683, 27466, 27245, 27019, 26790, 26556,
+    26319, 26077, 25832, 25582, 25329, 25072, 24811, 24547, 24279, 24007,
+    23731, 23452, 23170, 22884, 22594, 22301, 22005, 21705, 21403, 21096,
+    20787, 20475, 20159, 19841, 19519, 19195, 18868, 18537, 18204, 17869,
+    17530, 17189, 16846, 16499, 16151, 15800, 15446, 15090, 14732, 14372,
+    14010, 13645, 13279, 12910, 12539, 12167, 11793, 11417, 11039, 10659,
+    10278, 9896, 9512, 9126, 8739, 8351, 7962, 7571, 7179, 6786,
+    6393, 5998, 5602, 5205, 4808, 4410, 4011, 3612, 3212, 2811,
+    2410, 2009, 1608, 1206, 804, 402, 0, -402, -804, -1206,
+    -1608, -2009, -2410, -2811, -3212, -3612, -4011, -4410, -4808, -5205,
+    -5602, -5998, -6393, -6786, -7179, -7571, -7962, -8351, -8739, -9126,
+    -9512, -9896, -10278, -10659, -11039, -11417, -11793, -12167, -12539, -12910,
+    -13279, -13645, -14010, -14372, -14732, -15090, -15446, -15800, -16151, -16499,
+    -16846, -17189, -17530, -17869, -18204, -18537, -18868, -19195, -19519, -19841,
+    -20159, -20475, -20787, -21096, -21403, -21705, -22005, -22301, -22594, -22884,
+    -23170, -23452, -23731, -24007, -24279, -24547, -24811, -25072, -25329, -25582,
+    -25832, -26077, -26319, -26556, -26790, -27019, -27245, -27466, -27683, -27896,
+    -28105, -28310, -28510, -28706, -28898, -29085, -29268, -29447, -29621, -29791,
+    -29956, -30117, -30273, -30424, -30571, -30714, -30852, -30985, -31113, -31237,
+    -31356, -31470, -31580, -31685, -31785, -31880, -31971, -32057, -32137, -32213,
+    -32285, -32351, -32412, -32469, -32521, -32567, -32609, -32646, -32678, -32705,
+    -32728, -32745, -32757, -32765, -32767, -32765, -32757, -32745, -32728, -32705,
+    -32678, -32646, -32609, -32567, -32521, -32469, -32412, -32351, -32285, -32213,
+    -32137, -32057, -31971, -31880, -31785, -31685, -31580, -31470, -31356, -31237,
+    -31113, -30985, -30852, -30714, -30571, -30424, -30273, -30117, -29956, -29791,
+    -29621, -29447, -29268, -29085, -28898, -28706, -28510, -28310, -28105, -27896,
+    -27683, -27466, -27245, -27019, -26790, -26556, -26319, -26077, -25832, -25582,
+    -25329, -25072, -24811, -24547, -24279, -24007, -23731, -23452, -23170, -22884,
+    -22594, -22301, -22005, -21705, -21403, -21096, -20787, -20475, -20159, -19841,
+    -19519, -19195, -18868, -18537, -18204, -17869, -17530, -17189, -16846, -16499,
+    -16151, -15800, -15446, -15090, -14732, -14372, -14010, -13645, -13279, -12910,
+    -12539, -12167, -11793, -11417, -11039, -10659, -10278, -9896, -9512, -9126,
+    -8739, -8351, -7962, -7571, -7179, -6786, -6393, -5998, -5602, -5205,
+    -4808, -4410, -4011, -3612, -3212, -2811, -2410, -2009, -1608, -1206,
+    -804, -402
+};
+
+/**
+ * @brief Gets the sine of an angle from the twiddle table
+ *
+ * @param index angle in units of 2 * pi / FFT_MAX_POINTS, taken modulo FFT_MAX_POINTS
+ * @return int16_t sine in Q15
+ */
+int16_t fft_sin_q15(uint32_t index) {
+    return sin_table[index % FFT_MAX_POINTS];
+}
+
+/**
+ * @brief Gets the cosine of an angle from the twiddle table
+ *
+ * @param index angle in units of 2 * pi / FFT_MAX_POINTS, taken modulo FFT_MAX_POINTS
+ * @return int16_t cosine in Q15
+ */
+int16_t fft_cos_q15(uint32_t index) {
+    return sin_table[(index + FFT_MAX_POINTS / 4) % FFT_MAX_POINTS];
+}
+
+/**
+ * @brief Computes the forward transform in place. Every stage is scaled, so the result
+ * is the DFT divided by the number of points and cannot overflow. The output is left in
+ * digit reversed order, see fft_q15_bin_position
+ *
+ * @param data interleaved real and imaginary parts, 2 * points values
+ * @param points number of points, a power of two from 4 up to FFT_MAX_POINTS
+ */
+void fft_q15(int16_t* data, uint32_t points) {
+    uint32_t length = points;
+    // Step between the twiddle factors of consecutive butterflies in the table
+    uint32_t stride = FFT_MAX_POINTS / points;
+
+    while (length >= 4) {
+        const uint32_t quarter = length / 4;
+        for (uint32_t j = 0; j < quarter; j++) {
+            for (uint32_t index = j; index < points; index += length) {
+                butterfly_radix4(data, index, quarter, j * stride);
+            }
+        }
+        length = quarter;
+        stride *= 4;
+    }
+
+    // When the number of points is an odd power of two, a radix-2 stage without
+    // twiddles is left at the end
+    if (length == 2) {
+        for (uint32_t index = 0; index < 2 * points; index += 4) {
+            const int32_t a_real      = data[index];
+            const int32_t a_imaginary = data[index + 1];
+            const int32_t b_real      = data[index + 2];
+            const int32_t b_imaginary = data[index + 3];
+            data[index]               = (a_real + b_real) >> 1;
+            data[index + 1]           = (a_imaginary + b_imaginary) >> 1;
+            data[index + 2]           = (a_real - b_real) >> 1;
+            data[index + 3]           = (a_imaginary - b_imaginary) >> 1;
+        }
+    }
+}
+
+/**
+ * @brief Gets where a frequency bin is stored after fft_q15
+ *
+ * @param bin frequency bin, from 0 to points - 1
+ * @param points number of points of the transform
+ * @return uint32_t index of the complex value of the bin in the data
+ */
+uint32_t fft_q15_bin_position(uint32_t bin, uint32_t points) {
+    // Each stage takes the next digit of the bin, starting by the least significant, and
+    // places it in the most significant digit still free of the position
+    uint32_t position = 0;
+    uint32_t length   = points;
+    while (length >= 4) {
+        length /= 4;
+        position += (bin & 3) * length;
+        bin >>= 2;
+    }
+    if (length == 2) {
+        position += bin & 1;
+    }
+    return position;
+}
+
+static void butterfly_radix4(int16_t* data, uint32_t index, uint32_t quarter,
+                             uint32_t twiddle) {
+    int16_t* a = &data[2 * index];
+    int16_t* b = &data[2 * (index + quarter)];
+    int16_t* c = &data[2 * (index + 2 * quarter)];
+    int16_t* d = &data[2 * (index + 3 * quarter)];
+
+    const int32_t sum_ac_real             = a[0] + c[0];
+    const int32_t sum_ac_imaginary        = a[1] + c[1];
+    const int32_t difference_ac_real      = a[0] - c[0];
+    const int32_t difference_ac_imaginary = a[1] - c[1];
+    const int32_t sum_bd_real             = b[0] + d[0];
+    const int32_t sum_bd_imaginary        = b[1] + d[1];
+    const int32_t difference_bd_real      = b[0] - d[0];
+    const int32_t difference_bd_imaginary = b[1] - d[1];
+
+    // Outputs of the DFT of 4 points, the odd ones use -j * (b - d) and j * (b - d)
+    a[0] = (sum_ac_real + sum_bd_real) >> 2;
+    a[1] = (sum_ac_imaginary + sum_bd_imaginary) >> 2;
+    store_rotated(b, (difference_ac_real + difference_bd_imaginary) >> 2,
+                  (difference_ac_imaginary - difference_bd_real) >> 2, twiddle);
+    store_rotated(c, (sum_ac_real - sum_bd_real) >> 2,
+                  (sum_ac_imaginary - sum_bd_imaginary) >> 2, 2 * twiddle);
+    store_rotated(d, (difference_ac_real - difference_bd_imaginary) >> 2,
+                  (difference_ac_imaginary + difference_bd_real) >> 2, 3 * twiddle);
+}
+
+static void store_rotated(int16_t* data, int32_t real, int32_t imaginary,
+                          uint32_t twiddle) {
+    const int32_t cosine = sin_table[(twiddle + FFT_MAX_POINTS / 4) % FFT_MAX_POINTS];
+    const int32_t sine   = sin_table[twiddle % FFT_MAX_POINTS];
+
+    // (real + j * imaginary) * (cosine - j * sine)
+    data[0] = (real * cosine + imaginary * sine) >> 15;
+    data[1] = (imaginary * cosine - real * sine) >> 15;
+}
@@ -0,0 +1,84 @@
+/**
+ * @file fixed_math.c
+ * @brief Integer math kernels used by the measurement paths. The target has no FPU, so
+ * these replace the libm calls that would go through software double precision
+ *
+ */
+
+#include "application/fixed_math.h"
+
+/**
+ * @brief Integer square root of a 32 bit value. Computes one result bit per iteration,
+ * starting from the highest power of four not greater than the value, which is found
+ * with a single CLZ instruction
+ *
+ * @param value radicand
+ * @return uint32_t floor(sqrt(value))
+ */
+uint32_t fixed_math_isqrt32(uint32_t value) {
+    if (value == 0) {
+        return 0;
+    }
+
+    uint32_t result = 0;
+    uint32_t bit    = 1UL << ((31 - __builtin_clz(value)) & ~1UL);
+
+    while (bit != 0) {
+        if (value >= result + bit) {
+            value -= result + bit;
+            result = (result >> 1) + bit;
+        } else {
+            result >>= 1;
+        }
+        bit >>= 2;
+    }
+    return result;
+}
+
+/**
+ * @brief Integer square root of a 64 bit value. Values that fit in 32 bits use the
+ * faster 32 bit kernel
+ *
+ * @param value radicand
+ * @return uint32_t floor(sqrt(value))
+ */
+uint32_t fixed_math_isqrt64(uint64_t value) {
+    const uint32_t high = value >> 32;
+    if (high == 0) {
+        return fixed_math_isqrt32(value);
+    }
+
+    uint64_t result = 0;
+    uint64_t bit    = 1ULL << ((63 - __builtin_clz(high)) & ~1UL);
+
+    while (bit != 0) {
+        if (value >= result + bit) {
+            value -= result + bit;
+            result = (result >> 1) + bit;
+        } else {
+            result >>= 1;
+        }
+        bit >>= 2;
+    }
+    return result;
+}
+
+/**
+ * @brief Cosine of a small angle in fixed point. Evaluates the Taylor series up to the
+ * tenth power in Horner form, so the error is below 3e-9 in the valid range
+ *
+ * @param angle angle in radians in Q30, valid in the range [-1, 1]
+ * @return int32_t cosine in Q30
+ */
+int32_t fixed_math_cos_q30(int32_t angle) {
+    // Each step computes 1 - x^2 / ((2k - 1) * 2k) * (previous step)
+    static const int32_t divisors[] = {132, 90, 56, 30, 12, 2};
+
+    const int32_t square = ((int64_t)angle * angle) >> 30;
+    int32_t result       = FIXED_MATH_Q30_ONE;
+    for (uint32_t i = 0; i < sizeof(divisors) / sizeof(divisors[0]); i++) {
+        const int32_t product = ((int64_t)square * result) >> 30;
+        result                = FIXED_MATH_Q30_ONE - product / divisors[i];
+    }
+    return result;
+}
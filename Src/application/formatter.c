@@ -0,0 +1,113 @@
+/**
+ * @file formatter.c
+ * @brief Writes text and integers straight into a transmission buffer, without the
+ * format parsing of sprintf. Fractional values are kept as scaled integers and printed
+ * as fixed point decimals. Nothing is terminated, every function returns the number of
+ * characters written so calls can be chained on a running index
+ *
+ */
+
+#include "application/formatter.h"
+
+// Digits of the largest 32 bit value
+#define MAX_DIGITS 10
+
+/**
+ * @brief Gets the decimal digits of a value, least significant first
+ *
+ * @param digits where the digits are written, MAX_DIGITS characters
+ * @param value value to be converted
+ * @param min_digits the digits are padded with zeros up to this count
+ * @return uint32_t number of digits
+ */
+static uint32_t get_digits(char* digits, uint32_t value, uint32_t min_digits);
+
+/**
+ * @brief Writes a text
+ *
+ * @param buffer where the text is written
+ * @param text null terminated text, the terminator is not written
+ * @return int32_t number of characters written
+ */
+int32_t formatter_text(char* buffer, const char* text) {
+    int32_t length = 0;
+    while (text[length] != '\0') {
+        buffer[length] = text[length];
+        length++;
+    }
+    return length;
+}
+
+/**
+ * @brief Writes an unsigned integer in decimal
+ *
+ * @param buffer where the number is written, 10 characters at most
+ * @param value number to be written
+ * @return int32_t number of characters written
+ */
+int32_t formatter_uint(char* buffer, uint32_t value) {
+    char digits[MAX_DIGITS];
+    const uint32_t count = get_digits(digits, value, 1);
+    for (uint32_t i = 0; i < count; i++) {
+        buffer[i] = digits[count - 1 - i];
+    }
+    return count;
+}
+
+/**
+ * @brief Writes a signed integer in decimal
+ *
+ * @param buffer where the number is written, 11 characters at most
+ * @param value number to be written
+ * @return int32_t number of characters written
+ */
+int32_t formatter_int(char* buffer, int32_t value) {
+    if (value < 0) {
+        // Negated as unsigned, so the lowest value does not overflow
+        buffer[0] = '-';
+        return 1 + formatter_uint(buffer + 1, -(uint32_t)value);
+    }
+    return formatter_uint(buffer, value);
+}
+
+/**
+ * @brief Writes a fixed point decimal, a value scaled by a power of ten, with all of its
+ * decimals. For instance 1234 with 2 decimals is written as 12.34 and -5 as -0.05
+ *
+ * @param buffer where the number is written, 12 characters at most
+ * @param value number scaled by 10 to the power of decimals
+ * @param decimals number of decimals, limited by FORMATTER_MAX_DECIMALS
+ * @return int32_t number of characters written
+ */
+int32_t formatter_fixed(char* buffer, int32_t value, uint32_t decimals) {
+    char digits[MAX_DIGITS];
+    int32_t length = 0;
+
+    if (decimals > FORMATTER_MAX_DECIMALS) {
+        decimals = FORMATTER_MAX_DECIMALS;
+    }
+    // The sign is written apart, so values between -1 and 0 keep it
+    if (value < 0) {
+        buffer[length++] = '-';
+    }
+    const uint32_t magnitude = value < 0 ? -(uint32_t)value : (uint32_t)value;
+
+    // There is always one digit before the point
+    const uint32_t count = get_digits(digits, magnitude, decimals + 1);
+    for (uint32_t i = count; i > 0; i--) {
+        if (i == decimals) {
+            buffer[length++] = '.';
+        }
+        buffer[length++] = digits[i - 1];
+    }
+    return length;
+}
+
+static uint32_t get_digits(char* digits, uint32_t value, uint32_t min_digits) {
+    uint32_t count = 0;
+    do {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0 || count < min_digits);
+    return count;
+}
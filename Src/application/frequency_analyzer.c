@@ -0,0 +1,103 @@
+/**
+ * @file frequency_analyzer.c
+ * @brief Measures the mains frequency from the time between the zero crossings of the
+ * voltage, using the sample index interpolated between samples as time reference
+ *
+ */
+
+#include "application/frequency_analyzer.h"
+
+#include "application/acquisition.h"
+#include "usbd_cdc_if.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#define MAX_TX_SIZE 100
+
+static uint32_t averaged_cycles = FREQUENCY_ANALYZER_DEFAULT_CYCLES;
+
+// Crossing which started the average in progress and cycles counted since it
+static uint64_t first_crossing_q16;
+static uint32_t cycles;
+static bool has_first_crossing;
+
+static volatile uint32_t frequency_uHz;
+
+/**
+ * @brief Adds the time of a rising zero crossing. Every time the configured number of
+ * cycles is completed a new frequency is published. Called from the DMA interrupt
+ *
+ * @param timestamp_q16 time of the crossing, counted in samples, in Q16
+ */
+void frequency_analyzer_add_crossing(uint64_t timestamp_q16) {
+    if (!has_first_crossing) {
+        has_first_crossing = true;
+        first_crossing_q16 = timestamp_q16;
+        cycles             = 0;
+        return;
+    }
+
+    if (++cycles < averaged_cycles) {
+        return;
+    }
+
+    // f = cycles / (samples / sample rate). The numerator stays below 2^64 for every
+    // sample rate and number of cycles allowed
+    const uint64_t samples_q16 = timestamp_q16 - first_crossing_q16;
+    if (samples_q16 != 0) {
+        frequency_uHz =
+            ((acquisition_get_sample_rate_uHz() * cycles) << 16) / samples_q16;
+    }
+
+    // The last crossing starts the next average, so no cycle is lost between them
+    first_crossing_q16 = timestamp_q16;
+    cycles             = 0;
+}
+
+/**
+ * @brief Discards the crossings of the average in progress, for instance when the
+ * voltage is lost and the next crossing would not be one cycle later
+ *
+ */
+void frequency_analyzer_reset(void) {
+    has_first_crossing = false;
+}
+
+/**
+ * @brief Updates how many cycles are averaged in every measurement
+ *
+ * @param value number of cycles, limited by FREQUENCY_ANALYZER_MIN_CYCLES and
+ * FREQUENCY_ANALYZER_MAX_CYCLES
+ */
+void frequency_analyzer_update_cycles(int32_t value) {
+    char string_to_send[MAX_TX_SIZE];
+    int32_t tam;
+
+    if (value >= FREQUENCY_ANALYZER_MIN_CYCLES
+        && value <= FREQUENCY_ANALYZER_MAX_CYCLES) {
+        averaged_cycles = value;
+
+        tam = sprintf(string_to_send, "Frequency averaged over %" PRIu32 " cycles.\n",
+                      averaged_cycles);
+    } else {
+        tam = sprintf(string_to_send,
+                      "Value not allowed, allowed averages are %d to %d cycles.\n",
+                      FREQUENCY_ANALYZER_MIN_CYCLES, FREQUENCY_ANALYZER_MAX_CYCLES);
+    }
+
+    if (tam > MAX_TX_SIZE) {
+        return;
+    }
+    CDC_Transmit_FS((uint8_t*)string_to_send, tam);
+}
+
+/**
+ * @brief Gets the frequency measured over the last completed cycles
+ *
+ * @return uint32_t frequency in uHz, 0 while no measurement was completed
+ */
+uint32_t frequency_analyzer_get_frequency(void) {
+    return frequency_uHz;
+}
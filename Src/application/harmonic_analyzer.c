@@ -0,0 +1,230 @@
+/**
+ * @file harmonic_analyzer.c
+ * @brief Streaming Goertzel filter bank that measures the mains harmonics of voltage and
+ * current over every RMS window, one sample at a time
+ *
+ */
+
+#include "application/harmonic_analyzer.h"
+
+#include "application/fixed_math.h"
+#include "stm32f1xx.h"
+#include "usbd_cdc_if.h"
+
+#include <stdio.h>
+
+// 2 * pi in Q30
+#define TWO_PI_Q30 6746518852LL
+// sqrt(2) * 256, converts the peak value of a harmonic to rms in Q8
+#define SQUARE_ROOT_2_Q8 362
+// Largest ADC code after the offset is removed
+#define MAX_INPUT_CODE 2048
+// The filter states are kept below this value, so the magnitude calculation fits in 64
+// bits
+#define MAX_STATE (1L << 30)
+// Default selection is the fundamental and the odd harmonics up to the 7th
+#define DEFAULT_SELECTION 0x55
+
+#define MAX_TX_SIZE 100
+
+enum { channel_voltage, channel_current, channel_size };
+
+struct goertzel_state {
+    int32_t s1;
+    int32_t s2;
+};
+
+static uint16_t selection = DEFAULT_SELECTION;
+
+// Harmonics measured in the current window, and their coefficients 2 * cos(w) in Q30
+static uint8_t window_harmonics[HARMONIC_ANALYZER_MAX_HARMONIC];
+static int32_t window_coefficients[HARMONIC_ANALYZER_MAX_HARMONIC];
+static uint32_t window_size;
+static uint32_t input_shift;
+static struct goertzel_state states[channel_size][HARMONIC_ANALYZER_MAX_HARMONIC];
+
+// Results are double buffered, the interrupt writes into the buffer not published
+static uint32_t results[2][channel_size][HARMONIC_ANALYZER_MAX_HARMONIC];
+static volatile uint32_t published_results;
+
+/**
+ * @brief Starts a new window. Computes the filter coefficients for the selected
+ * harmonics and clears the filter states. Called from the DMA interrupt
+ *
+ * @param samples_per_cycle_q16 length of one mains cycle in samples, in Q16
+ * @param cycles expected number of cycles in the window, used to avoid overflows
+ */
+void harmonic_analyzer_start_window(uint32_t samples_per_cycle_q16, uint32_t cycles) {
+    window_size = 0;
+    // The cosine kernel is only valid up to 1 rad, which means at least 7 samples per
+    // cycle. Below that the fundamental cannot be measured anyway
+    if (samples_per_cycle_q16 < (7UL << 16)) {
+        return;
+    }
+
+    // The coefficients of every harmonic come from the fundamental one through the
+    // Chebyshev recursion 2cos((h + 1)w) = 2cos(w) * 2cos(hw) - 2cos((h - 1)w)
+    const int32_t angle = (TWO_PI_Q30 << 16) / samples_per_cycle_q16;
+    const int64_t fundamental = 2 * (int64_t)fixed_math_cos_q30(angle);
+    int64_t previous          = 2 * (int64_t)FIXED_MATH_Q30_ONE;
+    int64_t coefficient       = fundamental;
+
+    for (uint8_t harmonic = 1; harmonic <= HARMONIC_ANALYZER_MAX_HARMONIC; harmonic++) {
+        // Harmonics at or above half the sample rate alias, and just below it sin(hw)
+        // falls under sin(w), so their states would outgrow the bound below. They are
+        // skipped and read as zero, like the ones not selected
+        if (((2UL * (harmonic + 1)) << 16) > samples_per_cycle_q16) {
+            break;
+        }
+        if (selection & (1 << (harmonic - 1))) {
+            window_harmonics[window_size]    = harmonic;
+            window_coefficients[window_size] = coefficient;
+            window_size++;
+        }
+        const int64_t next = ((fundamental * coefficient) >> 30) - previous;
+        previous           = coefficient;
+        coefficient        = next;
+    }
+
+    // For a sine in the bin the state grows up to A * N / (2 * sin(w)), which is close
+    // to A * P^2 * cycles / (4 * pi) for P samples per cycle. The inputs are shifted
+    // down when needed to keep the states inside MAX_STATE
+    const uint64_t samples_per_cycle = samples_per_cycle_q16 >> 16;
+    const uint64_t max_state =
+        MAX_INPUT_CODE * samples_per_cycle * samples_per_cycle * cycles / 12;
+    input_shift = 0;
+    while ((max_state >> input_shift) >= MAX_STATE) {
+        input_shift++;
+    }
+
+    for (uint32_t i = 0; i < window_size; i++) {
+        states[channel_voltage][i] = (struct goertzel_state){0};
+        states[channel_current][i] = (struct goertzel_state){0};
+    }
+}
+
+/**
+ * @brief Runs one sample through the filters of every selected harmonic. Called from the
+ * DMA interrupt
+ *
+ * @param voltage voltage sample in ADC codes, with the offset removed
+ * @param current current sample in ADC codes, with the offset removed
+ */
+void harmonic_analyzer_update(int32_t voltage, int32_t current) {
+    voltage >>= input_shift;
+    current >>= input_shift;
+
+    for (uint32_t i = 0; i < window_size; i++) {
+        const int64_t coefficient = window_coefficients[i];
+        struct goertzel_state* v  = &states[channel_voltage][i];
+        struct goertzel_state* c  = &states[channel_current][i];
+
+        // s[n] = x[n] + 2cos(w) * s[n - 1] - s[n - 2]
+        const int32_t voltage_next = voltage + ((coefficient * v->s1) >> 30) - v->s2;
+        const int32_t current_next = current + ((coefficient * c->s1) >> 30) - c->s2;
+        v->s2                      = v->s1;
+        v->s1                      = voltage_next;
+        c->s2                      = c->s1;
+        c->s1                      = current_next;
+    }
+}
+
+/**
+ * @brief Finishes the window and publishes the magnitude of every selected harmonic.
+ * Called from the DMA interrupt
+ *
+ * @param samples number of samples in the window
+ */
+void harmonic_analyzer_finish_window(uint32_t samples) {
+    if (samples == 0) {
+        return;
+    }
+
+    const uint32_t buffer = published_results ^ 1;
+    for (uint32_t channel = 0; channel < channel_size; channel++) {
+        for (uint32_t i = 0; i < HARMONIC_ANALYZER_MAX_HARMONIC; i++) {
+            results[buffer][channel][i] = 0;
+        }
+        for (uint32_t i = 0; i < window_size; i++) {
+            const int64_t s1          = states[channel][i].s1;
+            const int64_t s2          = states[channel][i].s2;
+            const int64_t coefficient = window_coefficients[i];
+            // Squared magnitude of the last DFT term: s1^2 + s2^2 - 2cos(w) * s1 * s2
+            int64_t power = s1 * s1 + s2 * s2 - ((coefficient * s1) >> 30) * s2;
+            if (power < 0) {
+                power = 0;
+            }
+            // The DFT term of a sine of amplitude A is A * N / 2, so the rms value is
+            // sqrt(2) * |X| / N
+            const uint64_t magnitude = fixed_math_isqrt64(power);
+            results[buffer][channel][window_harmonics[i] - 1] =
+                ((magnitude * SQUARE_ROOT_2_Q8) << input_shift) / samples;
+        }
+    }
+    // The results must be completely written before being published
+    __DMB();
+    published_results = buffer;
+}
+
+/**
+ * @brief Updates which harmonics are measured and streamed
+ *
+ * @param value bit mask, bit 0 for the fundamental up to bit 14 for the 15th harmonic
+ */
+void harmonic_analyzer_update_selection(int32_t value) {
+    char string_to_send[MAX_TX_SIZE];
+    int32_t tam;
+
+    if (value > 0 && value < (1 << HARMONIC_ANALYZER_MAX_HARMONIC)) {
+        // Takes effect when the next window starts
+        selection = value;
+
+        tam = sprintf(string_to_send, "Harmonic selection set as 0x%04x.\n", selection);
+    } else {
+        tam = sprintf(string_to_send,
+                      "Value not allowed, selection is a mask from 1 to 0x%04x.\n",
+                      (1 << HARMONIC_ANALYZER_MAX_HARMONIC) - 1);
+    }
+
+    if (tam > MAX_TX_SIZE) {
+        return;
+    }
+    CDC_Transmit_FS((uint8_t*)string_to_send, tam);
+}
+
+/**
+ * @brief Gets which harmonics are measured
+ *
+ * @return uint16_t bit mask, bit 0 for the fundamental up to bit 14 for the 15th harmonic
+ */
+uint16_t harmonic_analyzer_get_selection(void) {
+    return selection;
+}
+
+/**
+ * @brief Gets the rms value of a voltage harmonic in the last window
+ *
+ * @param harmonic harmonic order, 1 for the fundamental
+ * @return uint32_t rms value in ADC codes, in Q8, zero when the harmonic is not
+ * measured
+ */
+uint32_t harmonic_analyzer_get_voltage(uint8_t harmonic) {
+    if (harmonic == 0 || harmonic > HARMONIC_ANALYZER_MAX_HARMONIC) {
+        return 0;
+    }
+    return results[published_results][channel_voltage][harmonic - 1];
+}
+
+/**
+ * @brief Gets the rms value of a current harmonic in the last window
+ *
+ * @param harmonic harmonic order, 1 for the fundamental
+ * @return uint32_t rms value in ADC codes, in Q8, zero when the harmonic is not
+ * measured
+ */
+uint32_t harmonic_analyzer_get_current(uint8_t harmonic) {
+    if (harmonic == 0 || harmonic > HARMONIC_ANALYZER_MAX_HARMONIC) {
+        return 0;
+    }
+    return results[published_results][channel_current][harmonic - 1];
+}
@@ -0,0 +1,158 @@
+/**
+ * @file oversampler.c
+ * @brief Oversampling and decimation of the slow channels, lux and temperature. Every
+ * output averages all the samples acquired in its period, which adds resolution beyond
+ * the 12 bits of the ADC
+ *
+ */
+
+#include "application/oversampler.h"
+
+#include "application/acquisition.h"
+#include "usbd_cdc_if.h"
+
+#include <stdio.h>
+
+#define MAX_TX_SIZE 100
+
+/**
+ * @brief Starts a new output period, with the number of samples given by the current
+ * sample rate and output rate
+ *
+ */
+static void start_period(void);
+
+/**
+ * @brief Gets how many bits an output averaged from some samples effectively has
+ *
+ * @param samples number of samples averaged
+ * @return uint32_t effective number of bits, from 12 to 12 + OVERSAMPLER_EXTRA_BITS
+ */
+static uint32_t get_effective_bits(uint32_t samples);
+
+static uint32_t output_rate = OVERSAMPLER_DEFAULT_OUTPUT_RATE;
+
+// The sums of 12 bit samples fit in 32 bits up to 2^20 samples, far more than a period
+// at the lowest output rate
+static uint32_t sums[oversampler_size];
+static uint32_t accumulated;
+static uint32_t samples_per_output;
+
+static volatile uint16_t outputs[oversampler_size];
+static volatile uint32_t effective_bits;
+
+/**
+ * @brief Accumulates samples of the slow channels and publishes a new output when the
+ * output period is completed. Called from the DMA interrupt
+ *
+ * @param samples pointer to the first lux sample, followed by the temperature sample
+ * @param count number of samples of each channel
+ * @param stride distance between consecutive samples of the same channel
+ */
+void oversampler_process_block(const uint16_t* samples, uint32_t count, uint32_t stride) {
+    if (samples_per_output == 0) {
+        start_period();
+    }
+
+    for (uint32_t i = 0; i < count; i++, samples += stride) {
+        for (uint32_t channel = 0; channel < oversampler_size; channel++) {
+            sums[channel] += samples[channel];
+        }
+        if (++accumulated < samples_per_output) {
+            continue;
+        }
+
+        // With 4^n samples this is the sum shifted right by n, scaled to the extra bits
+        for (uint32_t channel = 0; channel < oversampler_size; channel++) {
+            outputs[channel] =
+                ((uint64_t)sums[channel] << OVERSAMPLER_EXTRA_BITS) / accumulated;
+        }
+        effective_bits = get_effective_bits(accumulated);
+
+        start_period();
+    }
+}
+
+/**
+ * @brief Updates the rate of the outputs. Lower rates average more samples
+ *
+ * @param value output rate in Hz, limited by OVERSAMPLER_MIN_OUTPUT_RATE_HZ,
+ * OVERSAMPLER_MAX_OUTPUT_RATE_HZ and the rate of the slow samples
+ */
+void oversampler_update_output_rate(int32_t value) {
+    char string_to_send[MAX_TX_SIZE];
+    int32_t tam;
+
+    // In the injected mode the slow channels are sampled once per block, so a high
+    // output rate may have less than one sample per output
+    const uint32_t slow_rate = acquisition_get_slow_sample_rate();
+    uint32_t max_rate        = OVERSAMPLER_MAX_OUTPUT_RATE_HZ;
+    if (max_rate > slow_rate) {
+        max_rate = slow_rate;
+    }
+
+    if (value >= OVERSAMPLER_MIN_OUTPUT_RATE_HZ && (uint32_t)value <= max_rate) {
+        // Takes effect when the next period starts
+        output_rate = value;
+
+        const uint32_t samples = slow_rate / output_rate;
+        tam = sprintf(string_to_send,
+                      "Lux and temperature output rate set as %lu Hz, %lu samples per "
+                      "output, %lu effective bits.\n",
+                      output_rate, samples, get_effective_bits(samples));
+    } else {
+        tam = sprintf(string_to_send,
+                      "Value not allowed, allowed output rates are %d to %lu Hz.\n",
+                      OVERSAMPLER_MIN_OUTPUT_RATE_HZ, max_rate);
+    }
+
+    if (tam > MAX_TX_SIZE) {
+        return;
+    }
+    CDC_Transmit_FS((uint8_t*)string_to_send, tam);
+}
+
+/**
+ * @brief Gets the last output of a channel
+ *
+ * @param channel one of oversampler_channel
+ * @return uint16_t ADC code with OVERSAMPLER_EXTRA_BITS fractional bits
+ */
+uint16_t oversampler_get(enum oversampler_channel channel) {
+    if (channel >= oversampler_size) {
+        return 0;
+    }
+    return outputs[channel];
+}
+
+/**
+ * @brief Gets how many bits the last outputs effectively have, which depends on how many
+ * samples were averaged
+ *
+ * @return uint32_t effective number of bits, from 12 to 12 + OVERSAMPLER_EXTRA_BITS
+ */
+uint32_t oversampler_get_effective_bits(void) {
+    return effective_bits;
+}
+
+static void start_period(void) {
+    for (uint32_t channel = 0; channel < oversampler_size; channel++) {
+        sums[channel] = 0;
+    }
+    accumulated        = 0;
+    samples_per_output = acquisition_get_slow_sample_rate() / output_rate;
+    // A later change of the mode or of the sample rate may leave the output rate above
+    // the slow rate. Then every sample is an output, and the effective bits show it
+    if (samples_per_output == 0) {
+        samples_per_output = 1;
+    }
+}
+
+static uint32_t get_effective_bits(uint32_t samples) {
+    uint32_t extra_bits = 0;
+
+    while (extra_bits < OVERSAMPLER_EXTRA_BITS && samples >= (4UL << (2 * extra_bits))) {
+        extra_bits++;
+    }
+    return 12 + extra_bits;
+}
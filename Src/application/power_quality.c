@@ -0,0 +1,372 @@
+/**
+ * @file power_quality.c
+ * @brief Detects dips, swells and interruptions of the voltage with the rms of one mains
+ * cycle refreshed every half cycle, as IEC 61000-4-30. The events are logged in a ring
+ * that is drained by the host
+ *
+ */
+
+#include "application/power_quality.h"
+
+#include "application/acquisition.h"
+#include "application/fixed_math.h"
+#include "application/timer_handler.h"
+#include "application/unit_conversion.h"
+#include "stm32f1xx.h"
+#include "usbd_cdc_if.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+// Without zero crossings, for instance during an interruption, the half cycle is closed
+// after the time it would take at this frequency
+#define MIN_MAINS_FREQUENCY_HZ 40
+#define HYSTERESIS_Q8          VOLTAGE_REAL_mV_TO_BIT_Q8(POWER_QUALITY_HYSTERESIS_mV)
+
+// Must be a power of two, so the free running indexes can be wrapped with a mask
+#define EVENT_RING_SIZE 16
+#define EVENT_RING_MASK (EVENT_RING_SIZE - 1)
+
+#define MAX_TX_SIZE 100
+
+// The mean square of a cycle is shifted by 16 bits before its root, which must not
+// overflow for the longest cycle, at the highest rate
+#define MAX_CYCLE_SAMPLES                                                                \
+    (ACQUISITION_HIGHEST_SAMPLE_RATE_HZ / MIN_MAINS_FREQUENCY_HZ)
+_Static_assert((int64_t)MAX_CYCLE_SAMPLES * 4096 * 4096 <= INT64_MAX >> 16,
+               "Square sums can overflow in the longest cycle");
+
+enum event_type {
+    event_none,
+    event_dip,
+    event_swell,
+    event_interruption,
+    event_type_size
+};
+
+struct event {
+    uint32_t type;
+    // Time since power up of the half cycle which crossed the threshold
+    uint32_t start_ms;
+    uint32_t duration_ms;
+    // Lowest rms of a dip or interruption, highest rms of a swell, in Q8 codes
+    uint32_t extreme_q8;
+};
+
+struct half_cycle {
+    uint64_t sum_of_square;
+    uint32_t samples;
+};
+
+/**
+ * @brief Compares the rms of the last cycle with the thresholds, starting, updating or
+ * finishing the event in progress
+ *
+ * @param rms rms of the last cycle in Q8 codes
+ * @param samples number of samples of the last half cycle
+ */
+static void check_thresholds(uint32_t rms, uint32_t samples);
+
+/**
+ * @brief Starts a new event
+ *
+ * @param type type of the event
+ * @param rms rms of the cycle which crossed the threshold, in Q8 codes
+ * @param samples number of samples of the half cycle which crossed the threshold, the
+ * first one counted in the duration
+ */
+static void start_event(enum event_type type, uint32_t rms, uint32_t samples);
+
+/**
+ * @brief Finishes the event in progress and logs it in the ring
+ *
+ */
+static void finish_event(void);
+
+/**
+ * @brief Sends a text message through the USB
+ *
+ * @param message text to be sent
+ * @param tam size of the text, nothing is sent when larger than MAX_TX_SIZE
+ */
+static void send_message(const char* message, int32_t tam);
+
+static const char* const event_names[event_type_size] = {"none", "dip", "swell",
+                                                         "interruption"};
+
+// Single producer single consumer ring of finished events. The head is only written by
+// the DMA interrupt and the tail only by the main loop, so no lock is needed
+static struct event event_ring[EVENT_RING_SIZE];
+static volatile uint32_t event_head;
+static volatile uint32_t event_tail;
+static volatile uint32_t event_overruns;
+static volatile bool is_drain_requested;
+
+// Thresholds in mV for the messages, and in Q8 codes for the interrupt
+static int32_t dip_mV          = POWER_QUALITY_DEFAULT_DIP_mV;
+static int32_t swell_mV        = POWER_QUALITY_DEFAULT_SWELL_mV;
+static int32_t interruption_mV = POWER_QUALITY_DEFAULT_INTERRUPTION_mV;
+
+static volatile uint32_t dip_q8 =
+    VOLTAGE_REAL_mV_TO_BIT_Q8(POWER_QUALITY_DEFAULT_DIP_mV);
+static volatile uint32_t swell_q8 =
+    VOLTAGE_REAL_mV_TO_BIT_Q8(POWER_QUALITY_DEFAULT_SWELL_mV);
+static volatile uint32_t interruption_q8 =
+    VOLTAGE_REAL_mV_TO_BIT_Q8(POWER_QUALITY_DEFAULT_INTERRUPTION_mV);
+
+// Only used by the DMA interrupt. The reset is requested by other contexts and done
+// before the next sample, starting with the first one
+static struct half_cycle previous_half;
+static struct half_cycle current_half;
+static uint32_t max_half_cycle_samples;
+static struct event active_event;
+static uint32_t active_event_samples;
+static volatile bool is_reset_requested = true;
+
+static volatile uint32_t rms_q8;
+
+/**
+ * @brief Adds a sample to the half cycle in progress. Called from the DMA interrupt
+ *
+ * @param voltage voltage sample in ADC codes, with the offset removed
+ */
+void power_quality_update(int32_t voltage) {
+    if (is_reset_requested) {
+        is_reset_requested     = false;
+        previous_half          = (struct half_cycle){0};
+        current_half           = (struct half_cycle){0};
+        active_event.type      = event_none;
+        max_half_cycle_samples =
+            acquisition_get_sample_rate() / (2 * MIN_MAINS_FREQUENCY_HZ);
+    }
+
+    current_half.sum_of_square += (int64_t)voltage * voltage;
+    if (++current_half.samples >= max_half_cycle_samples) {
+        power_quality_finish_half_cycle();
+    }
+}
+
+/**
+ * @brief Closes the half cycle in progress at a zero crossing of the voltage, refreshes
+ * the rms of the last cycle and checks it against the thresholds. Called from the DMA
+ * interrupt
+ *
+ */
+void power_quality_finish_half_cycle(void) {
+    // The rms is taken over the last two half cycles, one whole cycle
+    const uint32_t samples = previous_half.samples + current_half.samples;
+    if (previous_half.samples != 0 && current_half.samples != 0) {
+        const uint64_t sum_of_square =
+            previous_half.sum_of_square + current_half.sum_of_square;
+        // The mean square is taken in Q16, so the root has 8 bits of fraction
+        rms_q8 = fixed_math_isqrt64((sum_of_square << 16) / samples);
+        check_thresholds(rms_q8, current_half.samples);
+    }
+
+    previous_half = current_half;
+    current_half  = (struct half_cycle){0};
+    max_half_cycle_samples =
+        acquisition_get_sample_rate() / (2 * MIN_MAINS_FREQUENCY_HZ);
+}
+
+/**
+ * @brief Discards the half cycles and the event in progress, for instance when the
+ * samples stop being processed
+ *
+ */
+void power_quality_reset(void) {
+    is_reset_requested = true;
+}
+
+/**
+ * @brief Sends the logged events when requested, one per call so the USB is not kept
+ * busy. Called from the main loop
+ *
+ */
+void power_quality_handler(void) {
+    if (!is_drain_requested) {
+        return;
+    }
+
+    char string_to_send[MAX_TX_SIZE];
+    int32_t tam;
+
+    const uint32_t tail = event_tail;
+    if (tail == event_head) {
+        tam = sprintf(string_to_send, "End of events, %" PRIu32 " lost.\n",
+                      event_overruns);
+        if (tam <= MAX_TX_SIZE
+            && CDC_Transmit_FS((uint8_t*)string_to_send, tam) == USBD_OK) {
+            is_drain_requested = false;
+        }
+        return;
+    }
+
+    // The head has been read before the event, which was written before the head
+    __DMB();
+    const struct event* event = &event_ring[tail & EVENT_RING_MASK];
+    tam = sprintf(string_to_send,
+                  "Event: %s at %" PRIu32 " ms, %" PRIu32 " ms, %" PRIu32 " mVrms.\n",
+                  event_names[event->type], event->start_ms, event->duration_ms,
+                  (uint32_t)VOLTAGE_BIT_Q8_TO_REAL_mV(event->extreme_q8));
+    // The event is only removed once it was accepted by the USB
+    if (tam <= MAX_TX_SIZE && CDC_Transmit_FS((uint8_t*)string_to_send, tam) == USBD_OK) {
+        __DMB();
+        event_tail = tail + 1;
+    }
+}
+
+/**
+ * @brief Requests the logged events to be sent, oldest first. Each event is removed from
+ * the ring once sent
+ *
+ */
+void power_quality_drain_events(void) {
+    is_drain_requested = true;
+}
+
+/**
+ * @brief Updates the dip threshold
+ *
+ * @param value threshold in mV rms, between the interruption and the swell thresholds
+ */
+void power_quality_update_dip(int32_t value) {
+    char string_to_send[MAX_TX_SIZE];
+    int32_t tam;
+
+    if (value > interruption_mV && value < swell_mV) {
+        dip_mV = value;
+        dip_q8 = VOLTAGE_REAL_mV_TO_BIT_Q8(dip_mV);
+        tam    = sprintf(string_to_send, "Dip threshold set as %" PRId32 " mVrms.\n",
+                         dip_mV);
+    } else {
+        tam = sprintf(string_to_send,
+                      "Value not allowed, allowed dips are %" PRId32 " to %" PRId32
+                      " mV.\n",
+                      interruption_mV + 1, swell_mV - 1);
+    }
+    send_message(string_to_send, tam);
+}
+
+/**
+ * @brief Updates the swell threshold
+ *
+ * @param value threshold in mV rms, above the dip threshold and limited by
+ * POWER_QUALITY_MAX_THRESHOLD_mV
+ */
+void power_quality_update_swell(int32_t value) {
+    char string_to_send[MAX_TX_SIZE];
+    int32_t tam;
+
+    if (value > dip_mV && value <= POWER_QUALITY_MAX_THRESHOLD_mV) {
+        swell_mV = value;
+        swell_q8 = VOLTAGE_REAL_mV_TO_BIT_Q8(swell_mV);
+        tam      = sprintf(string_to_send, "Swell threshold set as %" PRId32 " mVrms.\n",
+                           swell_mV);
+    } else {
+        tam = sprintf(string_to_send,
+                      "Value not allowed, allowed swells are %" PRId32 " to %d mV.\n",
+                      dip_mV + 1, POWER_QUALITY_MAX_THRESHOLD_mV);
+    }
+    send_message(string_to_send, tam);
+}
+
+/**
+ * @brief Updates the interruption threshold
+ *
+ * @param value threshold in mV rms, below the dip threshold
+ */
+void power_quality_update_interruption(int32_t value) {
+    char string_to_send[MAX_TX_SIZE];
+    int32_t tam;
+
+    if (value >= 0 && value < dip_mV) {
+        interruption_mV = value;
+        interruption_q8 = VOLTAGE_REAL_mV_TO_BIT_Q8(interruption_mV);
+        tam             = sprintf(string_to_send,
+                                  "Interruption threshold set as %" PRId32 " mVrms.\n",
+                                  interruption_mV);
+    } else {
+        tam = sprintf(string_to_send,
+                      "Value not allowed, allowed interruptions are 0 to %" PRId32
+                      " mV.\n",
+                      dip_mV - 1);
+    }
+    send_message(string_to_send, tam);
+}
+
+/**
+ * @brief Gets the rms of the last mains cycle, refreshed every half cycle
+ *
+ * @return int32_t voltage in mV RMS
+ */
+int32_t power_quality_get_rms(void) {
+    return VOLTAGE_BIT_Q8_TO_REAL_mV(rms_q8);
+}
+
+static void check_thresholds(uint32_t rms, uint32_t samples) {
+    if (active_event.type == event_none) {
+        if (rms < dip_q8) {
+            start_event(rms < interruption_q8 ? event_interruption : event_dip, rms,
+                        samples);
+        } else if (rms > swell_q8) {
+            start_event(event_swell, rms, samples);
+        }
+        return;
+    }
+
+    active_event_samples += samples;
+
+    // The event only ends when the rms is back past the threshold and the hysteresis
+    if (active_event.type == event_swell) {
+        if (rms > active_event.extreme_q8) {
+            active_event.extreme_q8 = rms;
+        }
+        if (rms + HYSTERESIS_Q8 < swell_q8) {
+            finish_event();
+        }
+        return;
+    }
+
+    if (rms < active_event.extreme_q8) {
+        active_event.extreme_q8 = rms;
+    }
+    // A dip which goes below the interruption threshold is logged as an interruption
+    if (rms < interruption_q8) {
+        active_event.type = event_interruption;
+    }
+    if (rms > dip_q8 + HYSTERESIS_Q8) {
+        finish_event();
+    }
+}
+
+static void start_event(enum event_type type, uint32_t rms, uint32_t samples) {
+    active_event.type       = type;
+    active_event.start_ms   = timer_update_ms();
+    active_event.extreme_q8 = rms;
+    active_event_samples    = samples;
+}
+
+static void finish_event(void) {
+    active_event.duration_ms =
+        ((uint64_t)active_event_samples * 1000) / acquisition_get_sample_rate();
+
+    const uint32_t head = event_head;
+    if (head - event_tail >= EVENT_RING_SIZE) {
+        event_overruns++;
+    } else {
+        event_ring[head & EVENT_RING_MASK] = active_event;
+        // The event must be completely written before the consumer can see the new head
+        __DMB();
+        event_head = head + 1;
+    }
+    active_event.type = event_none;
+}
+
+static void send_message(const char* message, int32_t tam) {
+    if (tam > MAX_TX_SIZE) {
+        return;
+    }
+    CDC_Transmit_FS((uint8_t*)message, tam);
+}
@@ -0,0 +1,267 @@
+/**
+ * @file spectrum_analyzer.c
+ * @brief Captures a block of the voltage or current samples from the DMA stream and
+ * computes its magnitude spectrum with the Q15 FFT
+ *
+ */
+
+#include "application/spectrum_analyzer.h"
+
+#include "application/acquisition.h"
+#include "application/fft.h"
+#include "application/fixed_math.h"
+#include "stm32f1xx.h"
+#include "usbd_cdc_if.h"
+
+#include <stdio.h>
+
+// Moves the 12 bit ADC codes to the 15 bit range of the transform input
+#define INPUT_SHIFT 3
+// A sine of amplitude A codes gives |X| = 8 * A / 2 / 2, after the input shift, the Hann
+// window gain and the split with the negative bin. So the rms value in Q8 is
+// |X| * 256 / (2 * sqrt(2))
+#define MAGNITUDE_TO_RMS_Q8(x) (((x) * 362) >> 2)
+
+#define MAX_TX_SIZE 100
+
+enum { state_idle, state_capturing, state_captured, state_processing };
+
+/**
+ * @brief Starts a new capture with the configured points and channel
+ *
+ */
+static void start_capture(void);
+
+/**
+ * @brief Removes the mean of the captured samples, applies the Hann window and clears
+ * the imaginary parts
+ *
+ */
+static void prepare_samples(void);
+
+/**
+ * @brief Computes the magnitude of every bin up to half the sample rate
+ *
+ */
+static void compute_magnitudes(void);
+
+static volatile uint32_t state = state_idle;
+static volatile bool is_activated;
+
+static uint32_t points                        = SPECTRUM_ANALYZER_DEFAULT_POINTS;
+static enum spectrum_analyzer_channel channel = spectrum_analyzer_voltage;
+
+// Configuration latched when the capture started, used by the interrupt
+static uint32_t capture_points;
+static uint32_t capture_rank;
+static uint32_t captured_scans;
+
+// Captured samples, transformed in place as interleaved real and imaginary parts
+static int16_t samples[2 * SPECTRUM_ANALYZER_MAX_POINTS];
+
+static uint32_t magnitudes[SPECTRUM_ANALYZER_MAX_POINTS / 2];
+static uint32_t published_bins;
+static uint32_t published_bin_width_mHz;
+static enum spectrum_analyzer_channel published_channel;
+
+/**
+ * @brief Copies the samples of the selected channel while a capture is in progress.
+ * Called from the DMA interrupt
+ *
+ * @param block pointer to the first scan of the block
+ * @param scans number of scans in the block
+ */
+void spectrum_analyzer_process_block(const uint16_t* block, uint32_t scans) {
+    if (state != state_capturing) {
+        return;
+    }
+
+    const uint32_t scan_size = acquisition_get_scan_size();
+    for (uint32_t i = 0; i < scans; i++, block += scan_size) {
+        samples[2 * captured_scans] = block[capture_rank];
+        if (++captured_scans >= capture_points) {
+            state = state_captured;
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Computes the spectrum of a finished capture and starts the next one. Called
+ * from the main loop, as the FFT takes too long to run in the interrupt
+ *
+ */
+void spectrum_analyzer_handler(void) {
+    if (state != state_captured) {
+        return;
+    }
+    state = state_processing;
+
+    prepare_samples();
+    fft_q15(samples, capture_points);
+    compute_magnitudes();
+
+    published_bins          = capture_points / 2;
+    published_bin_width_mHz = acquisition_get_sample_rate() * 1000 / capture_points;
+    published_channel       = capture_rank == ACQUISITION_RANK_VOLTAGE
+                                  ? spectrum_analyzer_voltage
+                                  : spectrum_analyzer_current;
+
+    if (is_activated) {
+        start_capture();
+    } else {
+        state = state_idle;
+    }
+}
+
+/**
+ * @brief Allows other files to start or stop the captures
+ *
+ * @param value true to capture continuously
+ */
+void spectrum_analyzer_set_is_activated(bool value) {
+    is_activated = value;
+    if (value && state == state_idle) {
+        start_capture();
+    } else if (!value && state == state_capturing) {
+        state = state_idle;
+    }
+}
+
+/**
+ * @brief Updates the number of points of the transform and restarts the capture
+ *
+ * @param value number of points, 256 or 512
+ */
+void spectrum_analyzer_update_points(int32_t value) {
+    char string_to_send[MAX_TX_SIZE];
+    int32_t tam;
+
+    if (value == SPECTRUM_ANALYZER_MIN_POINTS || value == SPECTRUM_ANALYZER_MAX_POINTS) {
+        points = value;
+        if (state == state_capturing) {
+            start_capture();
+        }
+
+        tam = sprintf(string_to_send, "Spectrum points set as %lu.\n", points);
+    } else {
+        tam = sprintf(string_to_send, "Value not allowed, allowed points are %d or %d.\n",
+                      SPECTRUM_ANALYZER_MIN_POINTS, SPECTRUM_ANALYZER_MAX_POINTS);
+    }
+
+    if (tam > MAX_TX_SIZE) {
+        return;
+    }
+    CDC_Transmit_FS((uint8_t*)string_to_send, tam);
+}
+
+/**
+ * @brief Updates which channel is captured and restarts the capture
+ *
+ * @param value channel, one of spectrum_analyzer_channel
+ */
+void spectrum_analyzer_update_channel(int32_t value) {
+    char string_to_send[MAX_TX_SIZE];
+    int32_t tam;
+
+    if (value >= 0 && value < spectrum_analyzer_channel_size) {
+        channel = value;
+        if (state == state_capturing) {
+            start_capture();
+        }
+
+        tam = sprintf(string_to_send, "Spectrum channel set as %s.\n",
+                      channel == spectrum_analyzer_voltage ? "voltage" : "current");
+    } else {
+        tam = sprintf(string_to_send,
+                      "Value not allowed, 0 for voltage or 1 for current.\n");
+    }
+
+    if (tam > MAX_TX_SIZE) {
+        return;
+    }
+    CDC_Transmit_FS((uint8_t*)string_to_send, tam);
+}
+
+/**
+ * @brief Gets the number of bins of the last spectrum, half of its number of points
+ *
+ * @return uint32_t number of bins, 0 while no spectrum was computed
+ */
+uint32_t spectrum_analyzer_get_bins(void) {
+    return published_bins;
+}
+
+/**
+ * @brief Gets the width of each bin of the last spectrum
+ *
+ * @return uint32_t bin width in mHz
+ */
+uint32_t spectrum_analyzer_get_bin_width(void) {
+    return published_bin_width_mHz;
+}
+
+/**
+ * @brief Gets which channel the last spectrum belongs to
+ *
+ * @return enum spectrum_analyzer_channel channel of the last spectrum
+ */
+enum spectrum_analyzer_channel spectrum_analyzer_get_channel(void) {
+    return published_channel;
+}
+
+/**
+ * @brief Gets the magnitude of one bin of the last spectrum
+ *
+ * @param bin frequency bin, from 0 to spectrum_analyzer_get_bins() - 1
+ * @return uint32_t rms value in ADC codes, in Q8
+ */
+uint32_t spectrum_analyzer_get_magnitude(uint32_t bin) {
+    if (bin >= published_bins) {
+        return 0;
+    }
+    return magnitudes[bin];
+}
+
+static void start_capture(void) {
+    state          = state_idle;
+    captured_scans = 0;
+    capture_points = points;
+    capture_rank   = channel == spectrum_analyzer_voltage ? ACQUISITION_RANK_VOLTAGE
+                                                          : ACQUISITION_RANK_CURRENT;
+    // The configuration must be visible to the interrupt before the capture starts
+    __DMB();
+    state = state_capturing;
+}
+
+static void prepare_samples(void) {
+    int32_t sum = 0;
+    for (uint32_t n = 0; n < capture_points; n++) {
+        sum += samples[2 * n];
+    }
+    const int32_t mean = sum / (int32_t)capture_points;
+
+    // Hann window, (1 - cos(2 * pi * n / points)) / 2 in Q15
+    const uint32_t stride = FFT_MAX_POINTS / capture_points;
+    for (uint32_t n = 0; n < capture_points; n++) {
+        // The sample may be negative, so it is scaled by a multiplication, a left shift
+        // of a negative value is undefined
+        const int32_t sample = (samples[2 * n] - mean) * (1 << INPUT_SHIFT);
+        const int32_t window = (32768 - fft_cos_q15(n * stride)) >> 1;
+        samples[2 * n]       = (sample * window) >> 15;
+        samples[2 * n + 1]   = 0;
+    }
+}
+
+static void compute_magnitudes(void) {
+    for (uint32_t bin = 0; bin < capture_points / 2; bin++) {
+        const uint32_t position = fft_q15_bin_position(bin, capture_points);
+        const int32_t real      = samples[2 * position];
+        const int32_t imaginary = samples[2 * position + 1];
+        // Each square is at most 2^30, for -32768, but both together can reach 2^31,
+        // which only fits unsigned
+        const uint32_t power =
+            (uint32_t)(real * real) + (uint32_t)(imaginary * imaginary);
+        magnitudes[bin]      = MAGNITUDE_TO_RMS_Q8(fixed_math_isqrt32(power));
+    }
+}
@@ -82,3 +82,24 @@ bool timer_wait_us(uint32_t timer_start, uint32_t delay) {
 uint32_t timer_update_us(void) {
     return __HAL_TIM_GET_COUNTER(&htim2);
 }
+
+/**
+ * @brief Starts the core cycle counter of the DWT unit, used to measure the execution
+ * time of code in CPU cycles
+ *
+ */
+void timer_cycles_init(void) {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+/**
+ * @brief Gets the current value of the core cycle counter
+ *
+ * @return uint32_t CPU cycles that have passed since timer_cycles_init was called. It
+ * overflows after approximately 59 seconds
+ */
+uint32_t timer_update_cycles(void) {
+    return DWT->CYCCNT;
+}
@@ -0,0 +1,84 @@
+/**
+ * @file unit_conversion.c
+ * @brief Conversion of the ADC codes to engineering units. The calibration of the analog
+ * front end is kept here, and the per sample conversions of voltage and current are
+ * tables built by the compiler, so each conversion is a single load from the flash
+ *
+ */
+
+#include "application/unit_conversion.h"
+
+#include "application/oversampler.h"
+
+#include <stdint.h>
+
+// The slopes of the sensors are applied in Q15, scaled to the output units and to the
+// oversampled codes. The float constants are only evaluated by the compiler
+#define CONVERSION_Q      15
+#define CONVERSION_HALF   (1 << (CONVERSION_Q - 1))
+#define OVERSAMPLED_SCALE (1 << OVERSAMPLER_EXTRA_BITS)
+#define TEMPERATURE_SLOPE_Q15                                                            \
+    ((int32_t)(TEMPERATURE_SLOPE * 100 * (1 << CONVERSION_Q) / OVERSAMPLED_SCALE + 0.5f))
+#define TEMPERATURE_INTERCEPT_x100 ((int32_t)(TEMPERATURE_INTERCEPT * 100 - 0.5f))
+#define LUX_SLOPE_Q15                                                                    \
+    ((int32_t)(LUX_SLOPE * 10 * (1 << CONVERSION_Q) / OVERSAMPLED_SCALE + 0.5f))
+#define LUX_INTERCEPT_x10 ((int32_t)(LUX_INTERCEPT * 10 - 0.5f))
+
+// Expands a conversion macro over consecutive codes, so the tables are filled by the
+// compiler with the exact values of the macros
+#define REPEAT_4(f, x) f(x), f((x) + 1), f((x) + 2), f((x) + 3)
+#define REPEAT_16(f, x)                                                                  \
+    REPEAT_4(f, x), REPEAT_4(f, (x) + 4), REPEAT_4(f, (x) + 8), REPEAT_4(f, (x) + 12)
+#define REPEAT_64(f, x)                                                                  \
+    REPEAT_16(f, x), REPEAT_16(f, (x) + 16), REPEAT_16(f, (x) + 32),                     \
+        REPEAT_16(f, (x) + 48)
+#define REPEAT_256(f, x)                                                                 \
+    REPEAT_64(f, x), REPEAT_64(f, (x) + 64), REPEAT_64(f, (x) + 128),                    \
+        REPEAT_64(f, (x) + 192)
+#define REPEAT_1024(f, x)                                                                \
+    REPEAT_256(f, x), REPEAT_256(f, (x) + 256), REPEAT_256(f, (x) + 512),                \
+        REPEAT_256(f, (x) + 768)
+#define REPEAT_4096(f)                                                                   \
+    REPEAT_1024(f, 0), REPEAT_1024(f, 1024), REPEAT_1024(f, 2048), REPEAT_1024(f, 3072)
+
+// The current is stored in a single byte, which halves the size of its table
+_Static_assert(CURRENT_BIT_TO_REAL_mA(0) >= INT8_MIN
+                   && CURRENT_BIT_TO_REAL_mA(UNIT_CONVERSION_ADC_CODES - 1) <= INT8_MAX,
+               "Current table values must fit in 8 bits");
+_Static_assert(VOLTAGE_BIT_TO_REAL_V(0) >= INT16_MIN
+                   && VOLTAGE_BIT_TO_REAL_V(UNIT_CONVERSION_ADC_CODES - 1) <= INT16_MAX,
+               "Voltage table values must fit in 16 bits");
+
+const int16_t unit_conversion_voltage_V[UNIT_CONVERSION_ADC_CODES] = {
+    REPEAT_4096(VOLTAGE_BIT_TO_REAL_V)};
+
+const int8_t unit_conversion_current_mA[UNIT_CONVERSION_ADC_CODES] = {
+    REPEAT_4096(CURRENT_BIT_TO_REAL_mA)};
+
+/**
+ * @brief Converts an oversampled lux code to lux, in integer math. Codes below the
+ * minimum of the sensor fit are taken as darkness
+ *
+ * @param code lux code with OVERSAMPLER_EXTRA_BITS of fraction
+ * @return int32_t value in tenths of lx
+ */
+int32_t unit_conversion_lux(uint16_t code) {
+    const int32_t offset_code = code - (LUX_CODE_OFFSET << OVERSAMPLER_EXTRA_BITS);
+    if (offset_code < (LUX_MIN_CODE << OVERSAMPLER_EXTRA_BITS)) {
+        return 0;
+    }
+    // The product stays below 31 bits, at most 63135 * 18665 which is about 1.18e9
+    return ((offset_code * LUX_SLOPE_Q15 + CONVERSION_HALF) >> CONVERSION_Q)
+           + LUX_INTERCEPT_x10;
+}
+
+/**
+ * @brief Converts an oversampled temperature code to temperature, in integer math
+ *
+ * @param code temperature code with OVERSAMPLER_EXTRA_BITS of fraction
+ * @return int32_t value in hundredths of celsius
+ */
+int32_t unit_conversion_temperature(uint16_t code) {
+    return ((code * TEMPERATURE_SLOPE_Q15 + CONVERSION_HALF) >> CONVERSION_Q)
+           + TEMPERATURE_INTERCEPT_x100;
+}
@@ -1,17 +1,45 @@
 #include "application/visualizer.h"
 
+#include "application/binary_frame.h"
 #include "application/electrical_analyzer.h"
+#include "application/formatter.h"
+#include "application/frequency_analyzer.h"
+#include "application/harmonic_analyzer.h"
+#include "application/power_quality.h"
+#include "application/spectrum_analyzer.h"
 #include "application/timer_handler.h"
 #include "usbd_cdc_if.h"
 
-#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #define MAX_FREQUENCY 500
 #define MIN_FREQUENCY 1
 #define MAX_TX_SIZE   100
+// Size of the streamed text lines. They are written in a static buffer, as the stack
+// also holds the interrupts and only has 1 KB
+#define MAX_LINE_SIZE 576
+// Number of spectrum bins sent in each line
+#define SPECTRUM_BINS_PER_LINE 32
+// The channels due together share a text line while it is shorter than this
+#define LINE_SPLIT_SIZE 112
+// Longest number written by the formatter, a fixed point decimal with its sign
+#define MAX_NUMBER_SIZE 12
+// Longest text of a channel, but the harmonics and the spectrum
+#define MAX_CHANNEL_SIZE 128
+// Longest text of each selected harmonic, its order, voltage and current
+#define MAX_HARMONIC_SIZE (sizeof("h15  mV  uA, \t") - 1 + 2 * MAX_NUMBER_SIZE)
+// Longest text of a spectrum line, the bin width, the first bin and their magnitudes
+#define MAX_SPECTRUM_SIZE                                                                \
+    (sizeof(" mHz/bin, bin  (mV):\t") - 1 + 2 * MAX_NUMBER_SIZE                          \
+     + SPECTRUM_BINS_PER_LINE * (MAX_NUMBER_SIZE + 1))
+// The streaming waits this long after the channels are changed, so the reply can be read
+#define SHOW_PAUSE_MS 1000
 
+#define CHANNEL_BIT(channel) (1UL << (channel))
+
+// The ids are also the channels of the binary frames. The presets are not measurements,
+// they subscribe to a group of channels at the same rate, so they are printed together
 enum {
     channel_none,
     channel_temperature,
@@ -19,21 +47,187 @@ enum {
     channel_voltage,
     channel_current,
     channel_power,
-    channel_voltage_current_power,
-    channel_lux_temperature,
+    preset_voltage_current_power,
+    preset_lux_temperature,
     channel_voltage_rms,
     channel_current_rms,
     channel_power_rms,
-    channel_voltage_current_power_rms,
+    preset_voltage_current_power_rms,
+    channel_power_analysis,
+    channel_harmonics,
+    channel_spectrum,
+    channel_frequency,
+    channel_offsets,
+    channel_voltage_peaks,
+    channel_current_peaks,
+    channel_half_cycle_rms,
     channel_size
-} channel_to_visualize = channel_none;
+};
+
+_Static_assert(channel_size <= 32, "The subscriptions are a 32 bit mask");
+_Static_assert(HARMONIC_ANALYZER_MAX_HARMONIC * MAX_HARMONIC_SIZE < MAX_LINE_SIZE
+                   && MAX_SPECTRUM_SIZE < MAX_LINE_SIZE,
+               "Every channel fits in a text line with its new line");
+
+enum { format_text, format_binary, format_size };
+
+/**
+ * @brief Gets the channels subscribed by a channel or a preset
+ *
+ * @param channel channel or preset
+ * @return uint32_t mask of channels
+ */
+static uint32_t get_members(uint32_t channel);
+
+/**
+ * @brief Subscribes to channels at a frequency, their timers start again together
+ *
+ * @param channels mask of channels
+ * @param frequency output frequency, between MIN_FREQUENCY and MAX_FREQUENCY
+ */
+static void subscribe(uint32_t channels, uint32_t frequency);
+
+/**
+ * @brief Activates the spectrum analyzer only while its channel is subscribed. The
+ * electrical analyzer always runs, as it integrates the energy
+ *
+ */
+static void update_analyzers(void);
+
+/**
+ * @brief Prints the values of a channel, in a text line shared with the other channels
+ * due at the same time
+ *
+ * @param buffer where the text is written
+ * @param channel channel to be printed
+ * @return int32_t number of characters written
+ */
+static int32_t print_channel(char* buffer, uint32_t channel);
+
+/**
+ * @brief Gets the longest text a channel may print, which fits in an empty line
+ *
+ * @param channel channel to be printed
+ * @return uint32_t number of characters
+ */
+static uint32_t get_max_size(uint32_t channel);
 
-static uint16_t configured_period_ms = 1000;
+/**
+ * @brief Gets the values of a channel, in the same units as the text
+ *
+ * @param channel channel to be read
+ * @param values where the values are written, BINARY_FRAME_MAX_VALUES at most
+ * @return uint32_t number of values written
+ */
+static uint32_t get_values(uint32_t channel, int32_t* values);
+
+/**
+ * @brief Sends the values of a channel as a binary frame
+ *
+ * @param channel channel to be sent
+ */
+static void send_binary(uint32_t channel);
 
-static uint32_t visualizer_timer;
+/**
+ * @brief Sends a text message through the USB
+ *
+ * @param message text to be sent
+ * @param tam size of the text, nothing is sent when larger than MAX_LINE_SIZE
+ */
+static void send_message(const char* message, int32_t tam);
 
 /**
- * @brief updates the frequency of the data visualization
+ * @brief Prints the frequency of the subscribed channels as the reply of a command
+ *
+ * @param buffer where the text is written
+ * @param period_ms period of the channels
+ * @return int32_t number of characters written
+ */
+static int32_t print_frequency(char* buffer, uint32_t period_ms);
+
+/**
+ * @brief Prints the waveform statistics of a channel
+ *
+ * @param buffer where the text is written
+ * @param statistics statistics of the channel
+ * @param unit unit of the statistics
+ * @return int32_t number of characters written
+ */
+static int32_t print_statistics(char* buffer,
+                                const struct waveform_statistics* statistics,
+                                const char* unit);
+
+/**
+ * @brief Prints the temperature, kept in hundredths of celsius, with two decimals
+ *
+ * @param buffer where the text is written
+ * @return int32_t number of characters written
+ */
+static int32_t print_temperature(char* buffer);
+
+/**
+ * @brief Prints the lux, kept in tenths of lx, with one decimal
+ *
+ * @param buffer where the text is written
+ * @return int32_t number of characters written
+ */
+static int32_t print_lux(char* buffer);
+
+/**
+ * @brief Prints an integer followed by its unit and separator
+ *
+ * @param buffer where the text is written
+ * @param value value to be printed
+ * @param unit text printed after the value
+ * @return int32_t number of characters written
+ */
+static int32_t print_value(char* buffer, int32_t value, const char* unit);
+
+// Output frequency of the channels when shown or subscribed without a frequency, the
+// instant values are fast and the rest are updated every few cycles or slower
+static const uint16_t default_frequency[channel_size] = {
+    [channel_none]                     = 1,
+    [channel_temperature]              = 2,
+    [channel_lux]                      = 2,
+    [channel_voltage]                  = 500,
+    [channel_current]                  = 500,
+    [channel_power]                    = 500,
+    [preset_voltage_current_power]     = 500,
+    [preset_lux_temperature]           = 2,
+    [channel_voltage_rms]              = 2,
+    [channel_current_rms]              = 2,
+    [channel_power_rms]                = 2,
+    [preset_voltage_current_power_rms] = 2,
+    [channel_power_analysis]           = 2,
+    [channel_harmonics]                = 2,
+    [channel_spectrum]                 = 10,
+    [channel_frequency]                = 2,
+    [channel_offsets]                  = 2,
+    [channel_voltage_peaks]            = 2,
+    [channel_current_peaks]            = 2,
+    [channel_half_cycle_rms]           = 2,
+};
+
+static uint32_t format = format_text;
+
+// Mask of the subscribed channels, each one with its own period and timer
+static uint32_t subscribed_channels;
+static uint16_t channel_period_ms[channel_size];
+static uint32_t channel_timer[channel_size];
+
+// First bin of the next spectrum line
+static uint32_t spectrum_bin;
+
+// Only used by the main loop, the commands reply with small buffers in the stack
+static char line[MAX_LINE_SIZE];
+
+// Nothing is streamed until the pause after a change of the channels has elapsed
+static uint32_t pause_timer;
+static uint32_t pause_ms;
+
+/**
+ * @brief updates the frequency of the data visualization, for all the subscribed
+ * channels
  *
  * @param value new frequency, limited by MIN_FREQUENCY and MAX_FREQUENCY;
  */
@@ -42,144 +236,440 @@ void visualizer_update_frequency(int32_t value) {
     int32_t tam;
 
     if (value >= MIN_FREQUENCY && value <= MAX_FREQUENCY) {
-        configured_period_ms = 1000 / value;
+        subscribe(subscribed_channels, value);
+        tam = print_frequency(string_to_send, 1000 / value);
+    } else {
+        tam = formatter_text(string_to_send,
+                             "Value not allowed, allowed frequencies are ");
+        tam += print_value(string_to_send + tam, MIN_FREQUENCY, " to ");
+        tam += print_value(string_to_send + tam, MAX_FREQUENCY, " Hz.\n");
+    }
 
-        tam = sprintf(string_to_send, "Frequency set as %d Hz, period is %d ms.\n",
-                      1000 / configured_period_ms, configured_period_ms);
+    send_message(string_to_send, tam);
+}
 
-    } else {
-        tam = sprintf(string_to_send,
-                      "Value not allowed, allowed frequencies are %d to %d Hz.\n",
-                      MIN_FREQUENCY, MAX_FREQUENCY);
+/**
+ * @brief Prints every subscribed channel whose period has elapsed. The channels due at
+ * the same time share a text line, in binary each one is a frame
+ *
+ */
+void visualizer_handler(void) {
+    uint16_t index = 0;
+
+    if (!timer_wait_ms(pause_timer, pause_ms)) {
+        return;
     }
 
-    if (tam > MAX_TX_SIZE) {
+    for (uint32_t channel = 0; channel < channel_size; channel++) {
+        if (!(subscribed_channels & CHANNEL_BIT(channel))
+            || !timer_wait_ms(channel_timer[channel], channel_period_ms[channel])) {
+            continue;
+        }
+        channel_timer[channel] = timer_update_ms();
+
+        if (format == format_binary) {
+            send_binary(channel);
+            continue;
+        }
+        // The line is sent before a channel that might not fit, with its new line
+        if (index >= LINE_SPLIT_SIZE || index + get_max_size(channel) >= MAX_LINE_SIZE) {
+            index += formatter_text(line + index, "\n");
+            send_message(line, index);
+            index = 0;
+        }
+        index += print_channel(line + index, channel);
+    }
+
+    if (index == 0) {
         return;
     }
-    CDC_Transmit_FS((uint8_t*)string_to_send, tam);
+    index += formatter_text(line + index, "\n");
+    send_message(line, index);
 }
 
 /**
- * @brief Print the selected channel in the selected fequency
+ * @brief Updates the format of the streamed values. The text is meant to be read, the
+ * binary frames of binary_frame.h to be decoded by a program at the full rate
  *
+ * @param value format, 0 for text or 1 for binary
  */
-void visualizer_handler(void) {
-    if (!timer_wait_ms(visualizer_timer, configured_period_ms)) {
+void visualizer_update_format(int32_t value) {
+    char string_to_send[MAX_TX_SIZE];
+    int32_t tam;
+
+    if (value >= 0 && value < format_size) {
+        format = value;
+        tam    = formatter_text(string_to_send,
+                                format == format_text ? "Format set as text.\n"
+                                                      : "Format set as binary.\n");
+    } else {
+        tam = formatter_text(string_to_send,
+                             "Value not allowed, 0 for text or 1 for binary.\n");
+    }
+
+    send_message(string_to_send, tam);
+}
+
+/**
+ * @brief Shows only a channel or the channels of a preset, at their default frequency.
+ * The streaming pauses for a second, so the reply can be read
+ *
+ * @param channel
+ */
+void visualizer_update_channels(uint8_t channel) {
+    char string_to_send[MAX_TX_SIZE];
+    int32_t index = 0;
+
+    if (channel >= channel_size) {
+        index += formatter_text(string_to_send, "Channel not allowed. ");
+        channel = channel_none;
+    }
+    index += formatter_text(string_to_send + index, "Showing channel: ");
+    index += formatter_uint(string_to_send + index, channel);
+    index += formatter_text(string_to_send + index, "\n");
+
+    subscribed_channels = 0;
+    subscribe(get_members(channel), default_frequency[channel]);
+    update_analyzers();
+    index += print_frequency(string_to_send + index, 1000 / default_frequency[channel]);
+
+    pause_timer = timer_update_ms();
+    pause_ms    = SHOW_PAUSE_MS;
+
+    send_message(string_to_send, index);
+}
+
+/**
+ * @brief Adds a channel, or the channels of a preset, to the shown channels with its own
+ * frequency. The other channels keep their frequencies
+ *
+ * @param channel channel or preset
+ * @param frequency output frequency, 0 for the default of the channel
+ */
+void visualizer_subscribe(int32_t channel, int32_t frequency) {
+    char string_to_send[MAX_TX_SIZE];
+    int32_t tam;
+
+    if (channel <= channel_none || channel >= channel_size) {
+        tam = formatter_text(string_to_send,
+                             "Channel not allowed, allowed channels are ");
+        tam += print_value(string_to_send + tam, channel_none + 1, " to ");
+        tam += print_value(string_to_send + tam, channel_size - 1, ".\n");
+        send_message(string_to_send, tam);
+        return;
+    }
+    if (frequency == 0) {
+        frequency = default_frequency[channel];
+    }
+    if (frequency < MIN_FREQUENCY || frequency > MAX_FREQUENCY) {
+        tam = formatter_text(string_to_send,
+                             "Value not allowed, allowed frequencies are ");
+        tam += print_value(string_to_send + tam, MIN_FREQUENCY, " to ");
+        tam += print_value(string_to_send + tam, MAX_FREQUENCY, " Hz.\n");
+        send_message(string_to_send, tam);
         return;
     }
-    visualizer_timer = timer_update_ms();
 
+    const uint32_t period_ms = 1000 / frequency;
+    subscribe(get_members(channel), frequency);
+    update_analyzers();
+
+    tam = formatter_text(string_to_send, "Subscribed channel ");
+    tam += print_value(string_to_send + tam, channel, " at ");
+    tam += formatter_uint(string_to_send + tam, 1000 / period_ms);
+    tam += formatter_text(string_to_send + tam, " Hz, period is ");
+    tam += print_value(string_to_send + tam, period_ms, " ms.\n");
+    send_message(string_to_send, tam);
+}
+
+/**
+ * @brief Removes a channel, or the channels of a preset, from the shown channels
+ *
+ * @param channel channel or preset, 0 removes all of them
+ */
+void visualizer_unsubscribe(int32_t channel) {
     char string_to_send[MAX_TX_SIZE];
-    uint8_t index = 0;
+    int32_t tam;
 
-    switch (channel_to_visualize) {
-        case channel_none: return;
-        case channel_temperature:
-            index += sprintf(string_to_send + index, "%.2f °C\t", get_temperature());
+    if (channel < channel_none || channel >= channel_size) {
+        tam = formatter_text(string_to_send,
+                             "Channel not allowed, allowed channels are ");
+        tam += print_value(string_to_send + tam, channel_none, " to ");
+        tam += print_value(string_to_send + tam, channel_size - 1, ".\n");
+        send_message(string_to_send, tam);
+        return;
+    }
+
+    subscribed_channels &= channel == channel_none ? 0 : ~get_members(channel);
+    update_analyzers();
+
+    tam = formatter_text(string_to_send, "Unsubscribed channel ");
+    tam += print_value(string_to_send + tam, channel, ".\n");
+    send_message(string_to_send, tam);
+}
 
+static uint32_t get_members(uint32_t channel) {
+    switch (channel) {
+        case channel_none: return 0;
+        case preset_voltage_current_power:
+            return CHANNEL_BIT(channel_voltage) | CHANNEL_BIT(channel_current)
+                   | CHANNEL_BIT(channel_power);
+        case preset_lux_temperature:
+            return CHANNEL_BIT(channel_temperature) | CHANNEL_BIT(channel_lux);
+        case preset_voltage_current_power_rms:
+            return CHANNEL_BIT(channel_voltage_rms) | CHANNEL_BIT(channel_current_rms)
+                   | CHANNEL_BIT(channel_power_rms);
+        default: return CHANNEL_BIT(channel);
+    }
+}
+
+static void subscribe(uint32_t channels, uint32_t frequency) {
+    const uint32_t now = timer_update_ms();
+    subscribed_channels |= channels;
+    for (uint32_t channel = 0; channel < channel_size; channel++) {
+        if (channels & CHANNEL_BIT(channel)) {
+            channel_period_ms[channel] = 1000 / frequency;
+            channel_timer[channel]     = now;
+        }
+    }
+}
+
+static void update_analyzers(void) {
+    spectrum_analyzer_set_is_activated(subscribed_channels
+                                       & CHANNEL_BIT(channel_spectrum));
+}
+
+static int32_t print_channel(char* buffer, uint32_t channel) {
+    uint16_t index = 0;
+
+    switch (channel) {
+        case channel_temperature:
+            index += print_temperature(buffer + index);
+            index += formatter_text(buffer + index, "\t");
             break;
         case channel_lux:
-            index += sprintf(string_to_send + index, "%.1f lx\t", get_lux());
-
+            index += print_lux(buffer + index);
+            index += formatter_text(buffer + index, "\t");
             break;
         case channel_voltage:
-            index += sprintf(string_to_send + index, "%i V\t", get_instant_voltage());
+            index += print_value(buffer + index, get_instant_voltage(), " V\t");
             break;
         case channel_current:
-            index += sprintf(string_to_send + index, "%i mA\t", get_instant_current());
+            index += print_value(buffer + index, get_instant_current(), " mA\t");
             break;
         case channel_power:
-            index += sprintf(string_to_send + index, "%i mW\t", get_instant_power());
-            break;
-        case channel_voltage_current_power:
-            index += sprintf(string_to_send + index, "%i V\t", get_instant_voltage());
-            index += sprintf(string_to_send + index, "%i mA\t", get_instant_current());
-            index += sprintf(string_to_send + index, "%i mW\t", get_instant_power());
-            break;
-        case channel_lux_temperature:
-            index += sprintf(string_to_send + index, "%.2f °C, \t", get_temperature());
-            index += sprintf(string_to_send + index, "%.1f lx\t", get_lux());
+            index += print_value(buffer + index, get_instant_power(), " mW\t");
             break;
         case channel_voltage_rms:
-            index += sprintf(string_to_send + index, "%i Vrms\t", get_voltage_rms());
+            index += print_value(buffer + index, get_voltage_rms(), " mVrms\t");
             break;
         case channel_current_rms:
-            index += sprintf(string_to_send + index, "%i Arms\t", get_current_rms());
+            index += print_value(buffer + index, get_current_rms(), " uArms\t");
             break;
         case channel_power_rms:
-            index += sprintf(string_to_send + index, "%i mW\t", get_power_rms());
+            index += print_value(buffer + index, get_active_power(), " mW\t");
+            break;
+        case channel_power_analysis:
+            index += print_value(buffer + index, get_active_power(), " mW, \t");
+            index +=
+                print_value(buffer + index, get_apparent_power(), " mVA, \t");
+            index +=
+                print_value(buffer + index, get_reactive_power(), " mvar, \t");
+            index += formatter_text(buffer + index, "PF ");
+            index += print_value(buffer + index, get_power_factor(), "/1000\t");
             break;
-        case channel_voltage_current_power_rms:
-            index += sprintf(string_to_send + index, "%i Vrms, \t", get_voltage_rms());
-            index += sprintf(string_to_send + index, "%i mArms, \t", get_current_rms());
-            index += sprintf(string_to_send + index, "%i mW\t", get_power_rms());
+        case channel_harmonics:
+            for (uint8_t h = 1; h <= HARMONIC_ANALYZER_MAX_HARMONIC; h++) {
+                if (!(harmonic_analyzer_get_selection() & (1 << (h - 1)))) {
+                    continue;
+                }
+                index += formatter_text(buffer + index, "h");
+                index += print_value(buffer + index, h, " ");
+                index +=
+                    print_value(buffer + index, get_voltage_harmonic(h), " mV ");
+                index += print_value(buffer + index, get_current_harmonic(h),
+                                     " uA, \t");
+            }
+            break;
+        case channel_spectrum: {
+            const uint32_t bins = spectrum_analyzer_get_bins();
+            const bool is_voltage =
+                spectrum_analyzer_get_channel() == spectrum_analyzer_voltage;
+            if (spectrum_bin >= bins) {
+                spectrum_bin = 0;
+            }
+            index +=
+                formatter_uint(buffer + index, spectrum_analyzer_get_bin_width());
+            index += formatter_text(buffer + index, " mHz/bin, bin ");
+            index += formatter_uint(buffer + index, spectrum_bin);
+            index += formatter_text(buffer + index,
+                                    is_voltage ? " (mV):\t" : " (uA):\t");
+            for (uint32_t i = 0; i < SPECTRUM_BINS_PER_LINE && spectrum_bin < bins; i++) {
+                index += print_value(buffer + index,
+                                     get_spectrum_magnitude(spectrum_bin++), "\t");
+            }
+            break;
+        }
+        case channel_frequency: {
+            const uint32_t frequency_uHz = frequency_analyzer_get_frequency();
+            index += formatter_fixed(buffer + index, frequency_uHz, 6);
+            index += formatter_text(buffer + index, " Hz\t");
+            break;
+        }
+        case channel_offsets:
+            index += formatter_text(buffer + index, "Offsets: ");
+            index += print_value(buffer + index, get_voltage_offset(), " uV, \t");
+            index += print_value(buffer + index, get_current_offset(), " uV\t");
+            break;
+        case channel_voltage_peaks:
+            index += print_statistics(buffer + index, get_voltage_statistics(),
+                                      "mV");
+            break;
+        case channel_current_peaks:
+            index += print_statistics(buffer + index, get_current_statistics(),
+                                      "uA");
+            break;
+        case channel_half_cycle_rms:
+            index += print_value(buffer + index, power_quality_get_rms(),
+                                 " mVrms(1/2)\t");
             break;
         default: {
         }
     }
 
-    sprintf(string_to_send + index++, "\n");
-
-    if (index > MAX_TX_SIZE) {
-        return;
-    }
-    CDC_Transmit_FS((uint8_t*)string_to_send, index);
+    return index;
 }
 
-/**
- * @brief Updates the channel which will be printed. Also configures the frequency as the
- * best for the channel
- *
- * @param channel
- */
-void visualizer_update_channels(uint8_t channel) {
-    char string_to_send[MAX_TX_SIZE];
-    int32_t index      = 0;
-    uint16_t frequency = 1;
-
-    if (channel >= channel_size) {
-        index += sprintf(string_to_send, "Channel not allowed. ");
-        channel_to_visualize = 0;
-    } else {
-        channel_to_visualize = channel;
+static uint32_t get_max_size(uint32_t channel) {
+    switch (channel) {
+        case channel_harmonics:
+            return __builtin_popcount(harmonic_analyzer_get_selection())
+                   * MAX_HARMONIC_SIZE;
+        case channel_spectrum: return MAX_SPECTRUM_SIZE;
+        default: return MAX_CHANNEL_SIZE;
     }
-    index += sprintf(string_to_send + index, "Showing channel: %d", channel_to_visualize);
+}
 
-    switch (channel_to_visualize) {
+static uint32_t get_values(uint32_t channel, int32_t* values) {
+    uint32_t count = 0;
 
-        case channel_none:
-            frequency = 1;
-            set_is_rms_acquisition_activated(false);
+    switch (channel) {
+        case channel_temperature: values[count++] = get_temperature(); break;
+        case channel_lux: values[count++] = get_lux(); break;
+        case channel_voltage: values[count++] = get_instant_voltage(); break;
+        case channel_current: values[count++] = get_instant_current(); break;
+        case channel_power: values[count++] = get_instant_power(); break;
+        case channel_voltage_rms: values[count++] = get_voltage_rms(); break;
+        case channel_current_rms: values[count++] = get_current_rms(); break;
+        case channel_power_rms: values[count++] = get_active_power(); break;
+        case channel_power_analysis:
+            values[count++] = get_active_power();
+            values[count++] = get_apparent_power();
+            values[count++] = get_reactive_power();
+            values[count++] = get_power_factor();
             break;
-        case channel_temperature:
-        case channel_lux:
-        case channel_lux_temperature:
-            frequency = 2;
-            set_is_rms_acquisition_activated(false);
+        case channel_harmonics:
+            // The selection tells which harmonics follow, voltage and current of each
+            values[count++] = harmonic_analyzer_get_selection();
+            for (uint8_t h = 1; h <= HARMONIC_ANALYZER_MAX_HARMONIC; h++) {
+                if (harmonic_analyzer_get_selection() & (1 << (h - 1))) {
+                    values[count++] = get_voltage_harmonic(h);
+                    values[count++] = get_current_harmonic(h);
+                }
+            }
             break;
-        case channel_voltage:
-        case channel_current:
-        case channel_power:
-        case channel_voltage_current_power:
-            frequency = 500;
-            set_is_rms_acquisition_activated(false);
+        case channel_spectrum: {
+            const uint32_t bins = spectrum_analyzer_get_bins();
+            if (spectrum_bin >= bins) {
+                spectrum_bin = 0;
+            }
+            values[count++] = spectrum_analyzer_get_bin_width();
+            values[count++] = spectrum_analyzer_get_channel();
+            values[count++] = spectrum_bin;
+            for (uint32_t i = 0; i < SPECTRUM_BINS_PER_LINE && spectrum_bin < bins; i++) {
+                values[count++] = get_spectrum_magnitude(spectrum_bin++);
+            }
             break;
-        case channel_voltage_rms:
-        case channel_current_rms:
-        case channel_power_rms:
-        case channel_voltage_current_power_rms:
-            frequency = 2;
-            set_is_rms_acquisition_activated(true);
+        }
+        case channel_frequency:
+            values[count++] = frequency_analyzer_get_frequency();
+            break;
+        case channel_offsets:
+            values[count++] = get_voltage_offset();
+            values[count++] = get_current_offset();
             break;
+        case channel_voltage_peaks:
+        case channel_current_peaks: {
+            const struct waveform_statistics* statistics =
+                channel == channel_voltage_peaks ? get_voltage_statistics()
+                                                 : get_current_statistics();
+            values[count++] = statistics->min;
+            values[count++] = statistics->max;
+            values[count++] = statistics->peak_to_peak;
+            values[count++] = statistics->crest_factor;
+            values[count++] = statistics->peak_hold;
+            break;
+        }
+        case channel_half_cycle_rms: values[count++] = power_quality_get_rms(); break;
         default: {
         }
     }
+    return count;
+}
+
+static void send_binary(uint32_t channel) {
+    static uint16_t sequence;
+    // Only used by the main loop, so they are kept out of the stack
+    static int32_t values[BINARY_FRAME_MAX_VALUES];
+    static uint8_t frame[BINARY_FRAME_MAX_SIZE];
+
+    const uint32_t count = get_values(channel, values);
+    // The sequence is counted even when the frame is not sent, so the host sees the gap
+    const uint32_t size = binary_frame_encode(channel, sequence++, values, count, frame);
+    CDC_Transmit_FS(frame, size);
+}
+
+static int32_t print_statistics(char* buffer,
+                                const struct waveform_statistics* statistics,
+                                const char* unit) {
+    int32_t length = formatter_text(buffer, "min ");
+    length += print_value(buffer + length, statistics->min, ", \tmax ");
+    length += print_value(buffer + length, statistics->max, ", \tpp ");
+    length += print_value(buffer + length, statistics->peak_to_peak, " ");
+    length += formatter_text(buffer + length, unit);
+    length += formatter_text(buffer + length, ", \tCF ");
+    length += print_value(buffer + length, statistics->crest_factor, "/1000, \thold ");
+    length += print_value(buffer + length, statistics->peak_hold, " ");
+    length += formatter_text(buffer + length, unit);
+    length += formatter_text(buffer + length, "\t");
+    return length;
+}
 
-    sprintf(string_to_send + index++, "\n");
+static int32_t print_temperature(char* buffer) {
+    const int32_t length = formatter_fixed(buffer, get_temperature(), 2);
+    return length + formatter_text(buffer + length, " °C");
+}
+
+static int32_t print_lux(char* buffer) {
+    const int32_t length = formatter_fixed(buffer, get_lux(), 1);
+    return length + formatter_text(buffer + length, " lx");
+}
 
-    CDC_Transmit_FS((uint8_t*)string_to_send, index);
-    visualizer_update_frequency(frequency);
+static int32_t print_value(char* buffer, int32_t value, const char* unit) {
+    const int32_t length = formatter_int(buffer, value);
+    return length + formatter_text(buffer + length, unit);
+}
+
+static void send_message(const char* message, int32_t tam) {
+    if (tam > MAX_LINE_SIZE) {
+        return;
+    }
+    CDC_Transmit_FS((uint8_t*)message, tam);
+}
 
-    // block the code for 1 second to allow the command to be read
-    HAL_Delay(1000);
+static int32_t print_frequency(char* buffer, uint32_t period_ms) {
+    int32_t length = formatter_text(buffer, "Frequency set as ");
+    length += formatter_uint(buffer + length, 1000 / period_ms);
+    length += formatter_text(buffer + length, " Hz, period is ");
+    return length + print_value(buffer + length, period_ms, " ms.\n");
 }
@@ -0,0 +1,204 @@
+/**
+ * @file waveform_stream.c
+ * @brief Continuous stream of the raw voltage and current samples, compressed by the
+ * delta codec and sent as binary frames. Keyframes carry the number of the first scan
+ * and are sent periodically and after any lost scans, so the host can resynchronize
+ *
+ */
+
+#include "application/waveform_stream.h"
+
+#include "application/acquisition.h"
+#include "application/binary_frame.h"
+#include "application/delta_codec.h"
+#include "application/formatter.h"
+#include "stm32f1xx.h"
+#include "usbd_cdc_if.h"
+
+#include <stdbool.h>
+
+// Must be a power of two, so the ring indexes can be wrapped with a mask
+#define RING_BLOCKS      2
+#define RING_MASK        (RING_BLOCKS - 1)
+#define FRAMES_PER_BLOCK (ACQUISITION_BLOCK_SCANS / WAVEFORM_STREAM_FRAME_SCANS)
+#define MAX_TX_SIZE      100
+
+_Static_assert(ACQUISITION_BLOCK_SCANS % WAVEFORM_STREAM_FRAME_SCANS == 0,
+               "The blocks must be split in whole frames");
+_Static_assert(DELTA_CODEC_MAX_VARINT_SIZE
+                       + DELTA_CODEC_MAX_SIZE(WAVEFORM_STREAM_FRAME_SCANS)
+                   <= BINARY_FRAME_MAX_PAYLOAD_SIZE,
+               "A keyframe must fit in the payload of a binary frame");
+
+/**
+ * @brief Clears the ring and the stream state and then enables or disables the stream
+ *
+ * @param status true to enable the stream
+ */
+static void apply_status(bool status);
+
+/**
+ * @brief Sends a text message through the USB
+ *
+ * @param message text to be sent
+ * @param tam size of the text, nothing is sent when larger than MAX_TX_SIZE
+ */
+static void send_message(const char* message, int32_t tam);
+
+static volatile bool is_enabled;
+// Requested by the USB interrupt and applied by the main loop, which owns the state
+static volatile bool is_status_requested;
+static volatile bool requested_status;
+
+// Voltage and current of every scan of the blocks waiting to be sent, and the number of
+// their first scan counted since the stream was enabled, including the dropped ones
+static uint16_t ring[RING_BLOCKS][ACQUISITION_BLOCK_SCANS][DELTA_CODEC_CHANNELS];
+static uint32_t ring_first_scan[RING_BLOCKS];
+static volatile uint32_t ring_head;
+static volatile uint32_t ring_tail;
+static uint32_t acquired_scans;
+
+// Used by the main loop only
+static struct delta_codec codec;
+static uint32_t sent_frames;
+static uint32_t frames_since_keyframe;
+static uint32_t next_scan;
+static uint16_t sequence;
+
+/**
+ * @brief Copies the voltage and current samples to the stream ring while the stream is
+ * enabled. A block which does not fit is dropped. Called from the DMA interrupt
+ *
+ * @param block pointer to the first scan of the block
+ * @param scans number of scans in the block, ACQUISITION_BLOCK_SCANS
+ */
+void waveform_stream_process_block(const uint16_t* block, uint32_t scans) {
+    if (!is_enabled) {
+        return;
+    }
+
+    // The scans are counted even when dropped, the gap is found by the main loop
+    const uint32_t first_scan = acquired_scans;
+    acquired_scans += scans;
+    if (ring_head - ring_tail >= RING_BLOCKS || scans != ACQUISITION_BLOCK_SCANS) {
+        return;
+    }
+
+    const uint32_t scan_size                 = acquisition_get_scan_size();
+    uint16_t(*samples)[DELTA_CODEC_CHANNELS] = ring[ring_head & RING_MASK];
+    for (uint32_t i = 0; i < scans; i++, block += scan_size) {
+        samples[i][0] = block[ACQUISITION_RANK_VOLTAGE];
+        samples[i][1] = block[ACQUISITION_RANK_CURRENT];
+    }
+    ring_first_scan[ring_head & RING_MASK] = first_scan;
+    // The block must be complete before the main loop sees it
+    __DMB();
+    ring_head++;
+}
+
+/**
+ * @brief Encodes and sends the frames stored in the ring while the USB accepts them.
+ * Called from the main loop
+ *
+ */
+void waveform_stream_handler(void) {
+    // Only used by the main loop, so they are kept out of the stack
+    static uint8_t payload[BINARY_FRAME_MAX_PAYLOAD_SIZE];
+    static uint8_t frame[BINARY_FRAME_MAX_SIZE];
+
+    if (is_status_requested) {
+        is_status_requested = false;
+        apply_status(requested_status);
+    }
+
+    while (is_enabled && ring_tail != ring_head) {
+        const uint32_t block = ring_tail & RING_MASK;
+        const uint32_t first = sent_frames * WAVEFORM_STREAM_FRAME_SCANS;
+        const uint32_t scan  = ring_first_scan[block] + first;
+
+        // A delta frame can only follow the frame of the scans right before it
+        struct delta_codec next_codec = codec;
+        const bool is_keyframe =
+            scan != next_scan
+            || frames_since_keyframe >= WAVEFORM_STREAM_KEYFRAME_INTERVAL;
+        uint32_t size = 0;
+        if (is_keyframe) {
+            size += delta_codec_put_varint(payload, scan);
+        }
+        size += delta_codec_encode(&next_codec, ring[block][first],
+                                   WAVEFORM_STREAM_FRAME_SCANS, is_keyframe,
+                                   &payload[size]);
+
+        const uint8_t channel     = is_keyframe ? WAVEFORM_STREAM_KEYFRAME_CHANNEL
+                                                : WAVEFORM_STREAM_DELTA_CHANNEL;
+        const uint32_t frame_size = binary_frame_encode_payload(
+            channel, WAVEFORM_STREAM_FRAME_SCANS, sequence, payload, size, frame);
+        // The frame is encoded again when the USB is full, the stream waits for it and
+        // scans are only lost when the ring overflows
+        if (CDC_Transmit_FS(frame, frame_size) != USBD_OK) {
+            return;
+        }
+
+        codec                 = next_codec;
+        frames_since_keyframe = is_keyframe ? 1 : frames_since_keyframe + 1;
+        next_scan             = scan + WAVEFORM_STREAM_FRAME_SCANS;
+        sequence++;
+        if (++sent_frames == FRAMES_PER_BLOCK) {
+            sent_frames = 0;
+            // The block must be read before the interrupt can overwrite it
+            __DMB();
+            ring_tail++;
+        }
+    }
+}
+
+/**
+ * @brief Enables or disables the stream
+ *
+ * @param value 1 to enable and 0 to disable
+ */
+void waveform_stream_update_status(int32_t value) {
+    char string_to_send[MAX_TX_SIZE];
+
+    if (value == 0 || value == 1) {
+        requested_status    = value;
+        is_status_requested = true;
+        return;
+    }
+    const int32_t tam = formatter_text(string_to_send, "Value not allowed, 0 or 1.\n");
+    send_message(string_to_send, tam);
+}
+
+static void apply_status(bool status) {
+    char string_to_send[MAX_TX_SIZE];
+    int32_t tam;
+
+    is_enabled = false;
+    // The interrupt does not touch the ring while the stream is disabled
+    __DMB();
+    ring_head      = 0;
+    ring_tail      = 0;
+    acquired_scans = 0;
+    sent_frames    = 0;
+    // The first frame is always a keyframe
+    next_scan = UINT32_MAX;
+    __DMB();
+    is_enabled = status;
+
+    tam = formatter_text(string_to_send, "Waveform stream ");
+    if (status) {
+        tam += formatter_text(string_to_send + tam, "enabled, ");
+        tam += formatter_uint(string_to_send + tam, acquisition_get_sample_rate());
+        tam += formatter_text(string_to_send + tam, " Hz.\n");
+    } else {
+        tam += formatter_text(string_to_send + tam, "disabled.\n");
+    }
+    send_message(string_to_send, tam);
+}
+
+static void send_message(const char* message, int32_t tam) {
+    if (tam > MAX_TX_SIZE) {
+        return;
+    }
+    CDC_Transmit_FS((uint8_t*)message, tam);
+}
@@ -64,6 +64,11 @@
   */
 
 /* USER CODE BEGIN PRIVATE_DEFINES */
+// UserTxBufferFS is used as a ring, its size must be a power of two so the free running
+// indexes can be wrapped with a mask
+#define TX_RING_MASK (APP_TX_DATA_SIZE - 1)
+_Static_assert((APP_TX_DATA_SIZE & TX_RING_MASK) == 0,
+               "APP_TX_DATA_SIZE must be a power of two");
 
 /* USER CODE END PRIVATE_DEFINES */
 
@@ -97,6 +102,14 @@ uint8_t UserRxBufferFS[APP_RX_DATA_SIZE];
 uint8_t UserTxBufferFS[APP_TX_DATA_SIZE];
 
 /* USER CODE BEGIN PRIVATE_VARIABLES */
+// The producers move the head and the completed transfers move the tail. Both are only
+// changed with the USB interrupt masked or from the USB interrupt itself
+static volatile uint32_t tx_head;
+static volatile uint32_t tx_tail;
+// Size of the transfer in progress, released from the ring when the transfer completes
+static volatile uint32_t tx_in_flight;
+// DataIn of the CDC class, wrapped so the next transfer starts when one completes
+static uint8_t (*cdc_class_data_in)(USBD_HandleTypeDef* pdev, uint8_t epnum);
 
 /* USER CODE END PRIVATE_VARIABLES */
 
@@ -130,6 +143,22 @@ static int8_t CDC_Control_FS(uint8_t cmd, uint8_t* pbuf, uint16_t length);
 static int8_t CDC_Receive_FS(uint8_t* pbuf, uint32_t *Len);
 
 /* USER CODE BEGIN PRIVATE_FUNCTIONS_DECLARATION */
+/**
+ * @brief Starts a transfer with everything queued in the ring, up to its end, if no
+ * transfer is in progress
+ *
+ */
+static void start_transmission(void);
+
+/**
+ * @brief Called by the USB core when an IN transfer completes. Runs the DataIn of the
+ * CDC class, which sends the zero length packet if needed, and starts the next transfer
+ *
+ * @param pdev device instance
+ * @param epnum endpoint number
+ * @return uint8_t status of the DataIn of the CDC class
+ */
+static uint8_t CDC_DataIn_FS(USBD_HandleTypeDef* pdev, uint8_t epnum);
 
 /* USER CODE END PRIVATE_FUNCTIONS_DECLARATION */
 
@@ -156,6 +185,14 @@ static int8_t CDC_Init_FS(void)
     /* Set Application Buffers */
     USBD_CDC_SetTxBuffer(&hUsbDeviceFS, UserTxBufferFS, 0);
     USBD_CDC_SetRxBuffer(&hUsbDeviceFS, UserRxBufferFS);
+    // The class starts with no transfer in progress, what was queued is discarded
+    tx_tail      = tx_head;
+    tx_in_flight = 0;
+    // The class is initialized again on every configuration, but only wrapped once
+    if (USBD_CDC.DataIn != CDC_DataIn_FS) {
+        cdc_class_data_in = USBD_CDC.DataIn;
+        USBD_CDC.DataIn   = CDC_DataIn_FS;
+    }
     return (USBD_OK);
   /* USER CODE END 3 */
 }
@@ -260,27 +297,74 @@ static int8_t CDC_Receive_FS(uint8_t* Buf, uint32_t *Len)
   *         Data to send over USB IN endpoint are sent over CDC interface
   *         through this function.
   *         @note
-  *
+  *         The data is copied to a ring and sent when the transfers before it
+  *         complete, so the buffer can be reused right away. Data queued while a
+  *         transfer is in progress is coalesced into the next transfer.
   *
   * @param  Buf: Buffer of data to be sent
   * @param  Len: Number of data to be sent (in bytes)
-  * @retval USBD_OK if all operations are OK else USBD_FAIL or USBD_BUSY
+  * @retval USBD_OK if all operations are OK else USBD_FAIL or USBD_BUSY, when
+  *         the ring has no room for the whole buffer and nothing was queued
   */
 uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len)
 {
   uint8_t result = USBD_OK;
   /* USER CODE BEGIN 7 */
-    USBD_CDC_HandleTypeDef* hcdc = (USBD_CDC_HandleTypeDef*)hUsbDeviceFS.pClassData;
-    if (hcdc->TxState != 0) {
-        return USBD_BUSY;
+    if (Len > APP_TX_DATA_SIZE) {
+        return USBD_FAIL;
     }
-    USBD_CDC_SetTxBuffer(&hUsbDeviceFS, Buf, Len);
-    result = USBD_CDC_TransmitPacket(&hUsbDeviceFS);
+
+    // Masks the producers in the USB interrupt and the completion of the transfers
+    HAL_NVIC_DisableIRQ(USB_LP_CAN1_RX0_IRQn);
+    const uint32_t head = tx_head;
+    if (APP_TX_DATA_SIZE - (head - tx_tail) < Len) {
+        result = USBD_BUSY;
+    } else {
+        // The data may wrap around the end of the ring
+        const uint32_t start        = head & TX_RING_MASK;
+        const uint32_t space_to_end = APP_TX_DATA_SIZE - start;
+        const uint32_t first_part   = space_to_end < Len ? space_to_end : Len;
+        memcpy(&UserTxBufferFS[start], Buf, first_part);
+        memcpy(UserTxBufferFS, &Buf[first_part], Len - first_part);
+        tx_head = head + Len;
+        start_transmission();
+    }
+    HAL_NVIC_EnableIRQ(USB_LP_CAN1_RX0_IRQn);
   /* USER CODE END 7 */
   return result;
 }
 
 /* USER CODE BEGIN PRIVATE_FUNCTIONS_IMPLEMENTATION */
+static void start_transmission(void) {
+    USBD_CDC_HandleTypeDef* hcdc = (USBD_CDC_HandleTypeDef*)hUsbDeviceFS.pClassData;
+    if (hcdc == NULL || hcdc->TxState != 0 || tx_in_flight != 0) {
+        return;
+    }
+
+    const uint32_t queued = tx_head - tx_tail;
+    if (queued == 0) {
+        return;
+    }
+    // Everything queued goes in a single transfer, which the USB sends as full packets
+    const uint32_t start      = tx_tail & TX_RING_MASK;
+    const uint32_t contiguous = APP_TX_DATA_SIZE - start;
+    tx_in_flight              = queued < contiguous ? queued : contiguous;
+    USBD_CDC_SetTxBuffer(&hUsbDeviceFS, &UserTxBufferFS[start], tx_in_flight);
+    USBD_CDC_TransmitPacket(&hUsbDeviceFS);
+}
+
+static uint8_t CDC_DataIn_FS(USBD_HandleTypeDef* pdev, uint8_t epnum) {
+    const uint8_t result         = cdc_class_data_in(pdev, epnum);
+    USBD_CDC_HandleTypeDef* hcdc = (USBD_CDC_HandleTypeDef*)pdev->pClassData;
+
+    // The transfer is only complete after the zero length packet, if one was needed
+    if (hcdc != NULL && hcdc->TxState == 0) {
+        tx_tail += tx_in_flight;
+        tx_in_flight = 0;
+        start_transmission();
+    }
+    return result;
+}
 
 /* USER CODE END PRIVATE_FUNCTIONS_IMPLEMENTATION */
 
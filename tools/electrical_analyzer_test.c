@@ -0,0 +1,349 @@
+/**
+ * @file electrical_analyzer_test.c
+ * @brief Host test of the block processing of the electrical analyzer. Synthetic sines
+ * are fed to electrical_analyzer_process_block in blocks, as the DMA interrupt does, and
+ * the windows and the measurements are checked against the values known from the
+ * amplitudes and the phase. A full scale square wave over the longest window, at the
+ * highest sample rate, checks that the sums do not overflow, which the undefined
+ * behavior sanitizer turns into an abort. The module is included as source, so the test
+ * can read the queue of windows. Built and run on the host with
+ *
+ * gcc -std=gnu17 -O2 -Wall -Wextra -Wshadow -fsanitize=undefined
+ *     -fno-sanitize-recover=all -Itools/host -IInc tools/electrical_analyzer_test.c
+ *     Src/application/fixed_math.c Src/application/harmonic_analyzer.c
+ *     Src/application/frequency_analyzer.c Src/application/power_quality.c
+ *     Src/application/unit_conversion.c -lm -o electrical_analyzer_test
+ *
+ */
+
+#include "../Src/application/electrical_analyzer.c"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define PI 3.14159265358979323846
+
+// The codes are rounded to integers, so the results are only checked to these limits
+#define RMS_TOLERANCE_PERCENT   0.2
+#define POWER_TOLERANCE_PERCENT 0.5
+#define POWER_FACTOR_TOLERANCE  5
+
+// Synthetic input of the analyzer, a sine of voltage and one of current
+struct signal {
+    uint32_t sample_rate;
+    double frequency;
+    double voltage_amplitude;
+    double current_amplitude;
+    // Lead of the current before the voltage, the phase delay of the transformer which
+    // is compensated by delaying the current
+    double current_lead_s;
+    // Square wave between the codes 0 and 4095 instead of the sine, the amplitudes only
+    // give the phase
+    bool is_full_scale;
+};
+
+/**
+ * @brief Starts the analyzer again at a sample rate, with an empty queue of windows
+ *
+ * @param sample_rate sample rate in Hz
+ * @param cycles cycles of every window
+ */
+static void start(uint32_t sample_rate, uint32_t cycles);
+
+/**
+ * @brief Feeds the samples of a signal to the analyzer, a whole block at a time, and
+ * checks every closed window before the main loop takes it. The windows must all hold
+ * the same number of cycles and the samples of these cycles
+ *
+ * @param signal signal to be sampled
+ * @param blocks number of blocks
+ * @param cycles expected cycles of every window, 0 when they close by timeout
+ * @return uint32_t number of failed checks
+ */
+static uint32_t feed(const struct signal* signal, uint32_t blocks, uint32_t cycles);
+
+/**
+ * @brief Checks a closed window
+ *
+ * @param signal signal which was fed
+ * @param window window to be checked
+ * @param cycles expected cycles of the window, 0 when it closes by timeout
+ * @return uint32_t 1 when the check failed, 0 otherwise
+ */
+static uint32_t check_window(const struct signal* signal,
+                             const struct measurement_window* window, uint32_t cycles);
+
+/**
+ * @brief Evaluates the windows in the queue and checks the rms, the power and the power
+ * factor
+ *
+ * @param signal signal which was fed
+ * @param expected_power_factor expected power factor of the compensated current
+ * @return uint32_t number of failed checks
+ */
+static uint32_t check_measurements(const struct signal* signal,
+                                   double expected_power_factor);
+
+/**
+ * @brief Compares a value with the expected one
+ *
+ * @param name name printed in the report
+ * @param value measured value
+ * @param expected expected value
+ * @param tolerance largest difference allowed
+ * @return uint32_t 1 when the check failed, 0 otherwise
+ */
+static uint32_t check(const char* name, double value, double expected, double tolerance);
+
+static uint16_t latest_scan[ACQUISITION_NUM_CHANNELS];
+static uint32_t test_sample_rate;
+static uint64_t sample_count;
+
+int main(void) {
+    uint32_t failures = 0;
+
+    // Whole number of samples per cycle, every window has the same length
+    const struct signal integer_cycle = {7680, 60.0, 1500.0, 1200.0, 0.0, false};
+    electrical_analyzer_update_phase_delay(0);
+    start(integer_cycle.sample_rate, DEFAULT_WINDOW_CYCLES);
+    failures += feed(&integer_cycle, 60, DEFAULT_WINDOW_CYCLES);
+    failures += check_measurements(&integer_cycle, 1.0);
+
+    // The current leads by the transformer phase delay, which is compensated
+    const struct signal leading = {7680, 60.0, 1500.0, 1200.0, 600e-6, false};
+    electrical_analyzer_update_phase_delay(600000);
+    start(leading.sample_rate, DEFAULT_WINDOW_CYCLES);
+    failures += feed(&leading, 60, DEFAULT_WINDOW_CYCLES);
+    failures += check_measurements(&leading, 1.0);
+
+    // The same lead without the compensation is measured as a phase shift
+    electrical_analyzer_update_phase_delay(0);
+    start(leading.sample_rate, DEFAULT_WINDOW_CYCLES);
+    failures += feed(&leading, 60, DEFAULT_WINDOW_CYCLES);
+    failures += check_measurements(&leading, cos(2 * PI * 60.0 * 600e-6));
+
+    // Fraction of sample per cycle at 50 Hz, the windows still close on the crossings
+    const struct signal fractional_cycle = {10000, 50.0, 1800.0, 900.0, 0.0, false};
+    start(fractional_cycle.sample_rate, 10);
+    failures += feed(&fractional_cycle, 80, 10);
+    failures += check_measurements(&fractional_cycle, 1.0);
+
+    // Without voltage there is no crossing, the windows close by timeout
+    const struct signal no_voltage = {7680, 60.0, 0.0, 500.0, 0.0, false};
+    start(no_voltage.sample_rate, DEFAULT_WINDOW_CYCLES);
+    failures += feed(&no_voltage, 60, 0);
+
+    // Codes of -2048 and 2047 in the longest window, closed by timeout at the lowest
+    // frequency just before its last crossing
+    const struct signal full_scale = {ACQUISITION_HIGHEST_SAMPLE_RATE_HZ,
+                                      MIN_MAINS_FREQUENCY_HZ, 1.0, 1.0, 0.0, true};
+    const uint32_t window_blocks =
+        ACQUISITION_HIGHEST_SAMPLE_RATE_HZ * MAX_WINDOW_CYCLES
+        / (MIN_MAINS_FREQUENCY_HZ * ACQUISITION_BLOCK_SCANS);
+    start(full_scale.sample_rate, MAX_WINDOW_CYCLES);
+    voltage_offset = UNIT_CONVERSION_ADC_CODES / 2;
+    current_offset = UNIT_CONVERSION_ADC_CODES / 2;
+    // The samples before the first crossing are discarded, the window after them must
+    // close within two window lengths
+    failures += feed(&full_scale, 2 * window_blocks, 0);
+    failures += check_measurements(&full_scale, 1.0);
+
+    printf("%s, %u failed checks\n", failures == 0 ? "PASS" : "FAIL", failures);
+    return failures == 0 ? 0 : 1;
+}
+
+uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len) {
+    (void)Buf;
+    (void)Len;
+    return USBD_OK;
+}
+
+void acquisition_init(void) {
+}
+
+uint32_t acquisition_get_sample_rate(void) {
+    return test_sample_rate;
+}
+
+uint64_t acquisition_get_sample_rate_uHz(void) {
+    return (uint64_t)test_sample_rate * 1000000;
+}
+
+uint32_t acquisition_get_scan_size(void) {
+    return ACQUISITION_NUM_CHANNELS;
+}
+
+const uint16_t* acquisition_get_latest_scan(void) {
+    return latest_scan;
+}
+
+const uint16_t* acquisition_get_previous_scan(uint32_t age) {
+    (void)age;
+    return latest_scan;
+}
+
+void acquisition_pause(void) {
+}
+
+void acquisition_resume(void) {
+}
+
+bool energy_storage_load(struct energy_counters* counters,
+                         struct calibration* stored_calibration) {
+    (void)counters;
+    (void)stored_calibration;
+    return false;
+}
+
+bool energy_storage_is_ready(void) {
+    return false;
+}
+
+bool energy_storage_save(const struct energy_counters* counters,
+                         const struct calibration* stored_calibration) {
+    (void)counters;
+    (void)stored_calibration;
+    return false;
+}
+
+bool energy_storage_erase_spare(void) {
+    return false;
+}
+
+uint16_t oversampler_get(enum oversampler_channel channel) {
+    (void)channel;
+    return 0;
+}
+
+enum spectrum_analyzer_channel spectrum_analyzer_get_channel(void) {
+    return spectrum_analyzer_voltage;
+}
+
+uint32_t spectrum_analyzer_get_magnitude(uint32_t bin) {
+    (void)bin;
+    return 0;
+}
+
+uint32_t timer_update_ms(void) {
+    return 0;
+}
+
+bool timer_wait_ms(uint32_t timer_start, uint32_t delay) {
+    (void)timer_start;
+    (void)delay;
+    return false;
+}
+
+static void start(uint32_t sample_rate, uint32_t cycles) {
+    test_sample_rate = sample_rate;
+    window_cycles    = cycles;
+    sample_count     = 0;
+    electrical_analyzer_reset();
+    voltage_offset    = VOLTAGE_REDUCED_OFFSET_BIT;
+    current_offset    = CURRENT_REDUCED_OFFSET_BIT;
+    window_queue_tail = window_queue_head;
+}
+
+static uint32_t feed(const struct signal* signal, uint32_t blocks, uint32_t cycles) {
+    static uint16_t block[ACQUISITION_BLOCK_SCANS][ACQUISITION_NUM_CHANNELS];
+    uint32_t failures = 0;
+    uint32_t windows  = 0;
+
+    for (uint32_t b = 0; b < blocks; b++) {
+        for (uint32_t i = 0; i < ACQUISITION_BLOCK_SCANS; i++) {
+            const double time = (double)sample_count++ / signal->sample_rate;
+            const double voltage =
+                signal->voltage_amplitude * sin(2 * PI * signal->frequency * time);
+            const double current =
+                signal->current_amplitude
+                * sin(2 * PI * signal->frequency * (time + signal->current_lead_s));
+            if (signal->is_full_scale) {
+                block[i][ACQUISITION_RANK_VOLTAGE] =
+                    voltage >= 0 ? UNIT_CONVERSION_ADC_CODES - 1 : 0;
+                block[i][ACQUISITION_RANK_CURRENT] =
+                    current >= 0 ? UNIT_CONVERSION_ADC_CODES - 1 : 0;
+                continue;
+            }
+            block[i][ACQUISITION_RANK_VOLTAGE] =
+                lround(VOLTAGE_REDUCED_OFFSET_BIT + voltage);
+            block[i][ACQUISITION_RANK_CURRENT] =
+                lround(CURRENT_REDUCED_OFFSET_BIT + current);
+        }
+
+        const uint32_t head = window_queue_head;
+        electrical_analyzer_process_block(&block[0][0], ACQUISITION_BLOCK_SCANS);
+        for (uint32_t w = head; w != window_queue_head; w++) {
+            failures +=
+                check_window(signal, &window_queue[w & WINDOW_QUEUE_MASK], cycles);
+            windows++;
+        }
+        // The main loop takes the windows before the queue is full
+        if (window_queue_head - window_queue_tail >= WINDOW_QUEUE_SIZE / 2) {
+            electrical_analyzer_handler();
+        }
+    }
+
+    if (windows == 0) {
+        printf("FAIL: no window was closed\n");
+        return failures + 1;
+    }
+    printf("%s: %u windows of %u cycles\n", failures == 0 ? "ok" : "FAIL", windows,
+           cycles);
+    return failures;
+}
+
+static uint32_t check_window(const struct signal* signal,
+                             const struct measurement_window* window, uint32_t cycles) {
+    // The windows closed by timeout last the configured cycles at the lowest frequency
+    const double expected_samples =
+        cycles != 0
+            ? cycles * signal->sample_rate / signal->frequency
+            : (double)signal->sample_rate * window_cycles / MIN_MAINS_FREQUENCY_HZ;
+
+    if (window->cycles != cycles || fabs(window->samples - expected_samples) > 1.0) {
+        printf("FAIL: window with %u cycles and %u samples, expected %u and %.1f\n",
+               window->cycles, window->samples, cycles, expected_samples);
+        return 1;
+    }
+    return 0;
+}
+
+static uint32_t check_measurements(const struct signal* signal,
+                                   double expected_power_factor) {
+    uint32_t failures = 0;
+
+    electrical_analyzer_handler();
+
+    // The square wave goes from -2048 to 2047, half a code around its mean
+    const double full_scale_rms = (UNIT_CONVERSION_ADC_CODES - 1) / 2.0;
+    const double voltage_rms_q8 =
+        (signal->is_full_scale ? full_scale_rms : signal->voltage_amplitude / sqrt(2))
+        * 256;
+    const double current_rms_q8 =
+        (signal->is_full_scale ? full_scale_rms : signal->current_amplitude / sqrt(2))
+        * 256;
+    const double expected_voltage_rms = VOLTAGE_BIT_Q8_TO_REAL_mV(voltage_rms_q8);
+    const double expected_current_rms = CURRENT_BIT_Q8_TO_REAL_uA(current_rms_q8);
+    const double apparent =
+        POWER_BIT2_Q8_TO_REAL_mW(voltage_rms_q8 * current_rms_q8 / 256);
+
+    failures += check("voltage rms (mV)", get_voltage_rms(), expected_voltage_rms,
+                      expected_voltage_rms * RMS_TOLERANCE_PERCENT / 100);
+    failures += check("current rms (uA)", get_current_rms(), expected_current_rms,
+                      expected_current_rms * RMS_TOLERANCE_PERCENT / 100);
+    failures += check("active power (mW)", get_active_power(),
+                      apparent * expected_power_factor,
+                      apparent * POWER_TOLERANCE_PERCENT / 100);
+    failures += check("power factor (/1000)", get_power_factor(),
+                      expected_power_factor * 1000, POWER_FACTOR_TOLERANCE);
+    return failures;
+}
+
+static uint32_t check(const char* name, double value, double expected, double tolerance) {
+    const bool is_passed = fabs(value - expected) <= tolerance;
+    printf("%s: %s %.1f, expected %.1f\n", is_passed ? "ok" : "FAIL", name, value,
+           expected);
+    return is_passed ? 0 : 1;
+}
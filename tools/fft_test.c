@@ -0,0 +1,163 @@
+/**
+ * @file fft_test.c
+ * @brief Host accuracy test of the Q15 FFT. For every number of points of the spectrum
+ * analyzer, the result is compared with a DFT in double precision of the same inputs,
+ * divided by the number of points as the scaled stages of the FFT. The error is given in
+ * LSB of the Q15 result. The time of a transform on the host is printed as well, the
+ * target cycles are measured by the bench command. Built and run on the host with
+ *
+ * gcc -std=c17 -O2 -IInc tools/fft_test.c Src/application/fft.c -lm -o fft_test
+ *
+ */
+
+#include "application/fft.h"
+#include "application/spectrum_analyzer.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PI 3.14159265358979323846
+
+// Transforms timed for every number of points, enough for a few hundred ms on the host
+#define SPEED_TRANSFORMS 20000
+
+// Largest error allowed in any bin, and of the rms over all the bins, in LSB. Each of
+// the scaled stages truncates, which measures up to 3.1 LSB and 1.2 LSB rms
+#define MAX_ERROR_LSB 4.0
+#define RMS_ERROR_LSB 1.5
+
+enum test_signal {
+    // Two tones off the bins and noise, as the mains with harmonics
+    signal_mains,
+    // A single tone at the full scale
+    signal_full_scale_tone,
+    // Uniform noise at the full scale, in the real and in the imaginary parts
+    signal_full_scale_noise,
+    signal_size
+};
+
+/**
+ * @brief Generates the inputs of a test, in Q15 and in double precision
+ *
+ * @param signal signal to be generated
+ * @param points number of points
+ * @param data Q15 inputs of the FFT, interleaved real and imaginary parts
+ * @param reference the same inputs in double precision
+ */
+static void generate(enum test_signal signal, uint32_t points, int16_t* data,
+                     double* reference);
+
+/**
+ * @brief Runs the FFT of a signal and compares every bin with the DFT
+ *
+ * @param signal signal to be tested
+ * @param points number of points
+ * @return true if the errors are inside the limits
+ */
+static bool test(enum test_signal signal, uint32_t points);
+
+/**
+ * @brief Measures the time of a transform on the host over the mains signal
+ *
+ * @param points number of points
+ */
+static void measure_speed(uint32_t points);
+
+static const char* const signal_names[signal_size] = {"mains", "full scale tone",
+                                                      "full scale noise"};
+
+static int16_t data[2 * FFT_MAX_POINTS];
+static int16_t inputs[2 * FFT_MAX_POINTS];
+static double reference[2 * FFT_MAX_POINTS];
+
+int main(void) {
+    uint32_t failures = 0;
+
+    for (uint32_t points = SPECTRUM_ANALYZER_MIN_POINTS;
+         points <= SPECTRUM_ANALYZER_MAX_POINTS; points *= 2) {
+        for (uint32_t signal = 0; signal < signal_size; signal++) {
+            failures += !test(signal, points);
+        }
+        measure_speed(points);
+    }
+
+    printf("%s, %u failed tests\n", failures == 0 ? "PASS" : "FAIL", failures);
+    return failures == 0 ? 0 : 1;
+}
+
+static void generate(enum test_signal signal, uint32_t points, int16_t* data,
+                     double* reference) {
+    srand(points + signal);
+    for (uint32_t n = 0; n < points; n++) {
+        double real      = 0.0;
+        double imaginary = 0.0;
+        switch (signal) {
+            case signal_mains:
+                real = 12000 * sin(2 * PI * 5.3 * n / points)
+                       + 3000 * cos(2 * PI * 17.7 * n / points) + rand() % 2001 - 1000;
+                break;
+            case signal_full_scale_tone:
+                real = INT16_MAX * cos(2 * PI * 7 * n / points);
+                break;
+            default:
+                real      = rand() % 65535 - INT16_MAX;
+                imaginary = rand() % 65535 - INT16_MAX;
+        }
+        data[2 * n]          = lround(real);
+        data[2 * n + 1]      = lround(imaginary);
+        reference[2 * n]     = data[2 * n];
+        reference[2 * n + 1] = data[2 * n + 1];
+    }
+}
+
+static bool test(enum test_signal signal, uint32_t points) {
+    generate(signal, points, data, reference);
+    fft_q15(data, points);
+
+    double max_error    = 0.0;
+    double square_error = 0.0;
+    for (uint32_t k = 0; k < points; k++) {
+        double real      = 0.0;
+        double imaginary = 0.0;
+        for (uint32_t n = 0; n < points; n++) {
+            // The angle is reduced before the sine, so it is exact for every k * n
+            const double angle = -2 * PI * ((k * n) % points) / points;
+            const double x     = reference[2 * n];
+            const double y     = reference[2 * n + 1];
+            real += x * cos(angle) - y * sin(angle);
+            imaginary += x * sin(angle) + y * cos(angle);
+        }
+
+        const uint32_t position      = fft_q15_bin_position(k, points);
+        const double real_error      = data[2 * position] - real / points;
+        const double imaginary_error = data[2 * position + 1] - imaginary / points;
+        max_error = fmax(max_error, fmax(fabs(real_error), fabs(imaginary_error)));
+        square_error += real_error * real_error + imaginary_error * imaginary_error;
+    }
+
+    const double rms_error = sqrt(square_error / (2 * points));
+    const bool is_passed   = max_error <= MAX_ERROR_LSB && rms_error <= RMS_ERROR_LSB;
+    printf("%s: %u points, %s, max error %.2f LSB, rms error %.3f LSB\n",
+           is_passed ? "ok" : "FAIL", points, signal_names[signal], max_error, rms_error);
+    return is_passed;
+}
+
+static void measure_speed(uint32_t points) {
+    generate(signal_mains, points, inputs, reference);
+
+    // The transform is done in place, so every one starts from a copy of the inputs,
+    // which takes a small part of the time
+    const clock_t start = clock();
+    for (uint32_t i = 0; i < SPEED_TRANSFORMS; i++) {
+        memcpy(data, inputs, 2 * points * sizeof(data[0]));
+        fft_q15(data, points);
+    }
+    const double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    printf("speed: %u points, %.2f us per transform on the host\n", points,
+           seconds * 1e6 / SPEED_TRANSFORMS);
+}
@@ -0,0 +1,96 @@
+/**
+ * @file fixed_math_test.c
+ * @brief Host accuracy test of the integer square roots. The 32 bit root is checked for
+ * every possible value. The 64 bit root is checked at both sides of every perfect
+ * square, where an error of the rounding would show, and for pseudo random values of
+ * every magnitude. It takes about 15 minutes. Built and run on the host with
+ *
+ * gcc -std=c17 -O2 -IInc tools/fixed_math_test.c Src/application/fixed_math.c
+ *     -o fixed_math_test
+ *
+ */
+
+#include "application/fixed_math.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define RANDOM_VALUES 100000000
+
+/**
+ * @brief Checks if a root is the floor of the square root of a value
+ *
+ * @param value radicand
+ * @param root root to be checked
+ * @return true if root^2 <= value < (root + 1)^2
+ */
+static bool is_floor_root(uint64_t value, uint64_t root);
+
+/**
+ * @brief Generates the next pseudo random value, with a xorshift generator
+ *
+ * @return uint64_t pseudo random value
+ */
+static uint64_t next_random(void);
+
+static uint64_t random_state = 88172645463325252ULL;
+
+int main(void) {
+    uint64_t failures = 0;
+
+    for (uint64_t value = 0; value <= UINT32_MAX; value++) {
+        if (!is_floor_root(value, fixed_math_isqrt32(value))) {
+            if (failures++ < 10) {
+                printf("FAIL: isqrt32(%llu) = %u\n", (unsigned long long)value,
+                       fixed_math_isqrt32(value));
+            }
+        }
+    }
+    printf("isqrt32: all %llu values checked\n", (unsigned long long)UINT32_MAX + 1);
+
+    for (uint64_t root = 1; root <= UINT32_MAX; root++) {
+        const uint64_t square = root * root;
+        if (!is_floor_root(square, fixed_math_isqrt64(square))
+            || !is_floor_root(square - 1, fixed_math_isqrt64(square - 1))) {
+            if (failures++ < 10) {
+                printf("FAIL: isqrt64 around %llu^2\n", (unsigned long long)root);
+            }
+        }
+    }
+    if (!is_floor_root(UINT64_MAX, fixed_math_isqrt64(UINT64_MAX))) {
+        printf("FAIL: isqrt64(UINT64_MAX) = %u\n", fixed_math_isqrt64(UINT64_MAX));
+        failures++;
+    }
+    printf("isqrt64: both sides of the %llu perfect squares checked\n",
+           (unsigned long long)UINT32_MAX);
+
+    for (uint32_t i = 0; i < RANDOM_VALUES; i++) {
+        // Every magnitude is tested, not only the large values
+        const uint64_t value = next_random() >> (i % 64);
+        if (!is_floor_root(value, fixed_math_isqrt64(value))) {
+            if (failures++ < 10) {
+                printf("FAIL: isqrt64(%llu) = %u\n", (unsigned long long)value,
+                       fixed_math_isqrt64(value));
+            }
+        }
+    }
+    printf("isqrt64: %d random values checked\n", RANDOM_VALUES);
+
+    printf("%s, %llu failed checks\n", failures == 0 ? "PASS" : "FAIL",
+           (unsigned long long)failures);
+    return failures == 0 ? 0 : 1;
+}
+
+static bool is_floor_root(uint64_t value, uint64_t root) {
+    // The next square does not fit in 64 bits for the largest root, any value is below it
+    const bool is_below_next = root >= UINT32_MAX || (root + 1) * (root + 1) > value;
+    return root * root <= value && is_below_next;
+}
+
+static uint64_t next_random(void) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
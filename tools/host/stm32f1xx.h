@@ -0,0 +1,14 @@
+/**
+ * @file stm32f1xx.h
+ * @brief Host replacement of the device header, for the tools which build application
+ * modules on the host. Only what those modules use is defined, and this directory must
+ * come before Inc in the include path
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+// The host tests are single threaded, a compiler and memory barrier is enough
+#define __DMB() __sync_synchronize()
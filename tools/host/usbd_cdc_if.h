@@ -0,0 +1,16 @@
+/**
+ * @file usbd_cdc_if.h
+ * @brief Host replacement of the USB CDC interface. Each tool defines CDC_Transmit_FS,
+ * usually to print or to check what the modules send
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define USBD_OK   0
+#define USBD_BUSY 1
+#define USBD_FAIL 2
+
+uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len);
@@ -0,0 +1,153 @@
+/**
+ * @file waveform_decoder.c
+ * @brief Host decoder of the waveform stream. Reads the bytes received from the USB on
+ * the standard input and writes every decoded scan as "scan,voltage,current" with the
+ * raw codes. Frames with a wrong CRC are discarded, and after a lost frame the delta
+ * frames are skipped until the next keyframe. Built on the host with
+ *
+ * gcc -std=c17 -O2 -IInc tools/waveform_decoder.c Src/application/delta_codec.c
+ *     Src/application/binary_frame.c -o waveform_decoder
+ *
+ */
+
+#include "application/binary_frame.h"
+#include "application/delta_codec.h"
+#include "application/waveform_stream.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * @brief Decodes a frame with Consistent Overhead Byte Stuffing, without its delimiter
+ *
+ * @param frame encoded frame
+ * @param size size of the frame
+ * @param record where the record is written, size bytes at most
+ * @return uint32_t size of the record, zero when the frame is malformed
+ */
+static uint32_t cobs_decode(const uint8_t* frame, uint32_t size, uint8_t* record);
+
+/**
+ * @brief Checks and decodes a record of the waveform stream and prints its scans
+ *
+ * @param record record without COBS
+ * @param size size of the record
+ */
+static void process_record(const uint8_t* record, uint32_t size);
+
+static struct delta_codec codec;
+static bool is_synchronized;
+static uint16_t expected_sequence;
+static uint32_t next_scan;
+static uint32_t discarded_frames;
+static uint32_t lost_frames;
+
+/**
+ * @brief Splits the input in frames on the zero delimiters and decodes them
+ *
+ * @return int 0
+ */
+int main(void) {
+    uint8_t frame[BINARY_FRAME_MAX_SIZE];
+    uint8_t record[BINARY_FRAME_MAX_SIZE];
+    uint32_t size = 0;
+    int byte;
+
+    while ((byte = getchar()) != EOF) {
+        if (byte != 0) {
+            // Longer runs are text messages or garbage, dropped up to the next delimiter
+            if (size < sizeof(frame)) {
+                frame[size] = byte;
+            }
+            size++;
+            continue;
+        }
+
+        const uint32_t record_size =
+            size <= sizeof(frame) ? cobs_decode(frame, size, record) : 0;
+        if (record_size == 0) {
+            discarded_frames++;
+        } else {
+            process_record(record, record_size);
+        }
+        size = 0;
+    }
+
+    fprintf(stderr, "%u frames discarded, %u frames lost.\n", discarded_frames,
+            lost_frames);
+    return 0;
+}
+
+static uint32_t cobs_decode(const uint8_t* frame, uint32_t size, uint8_t* record) {
+    uint32_t position = 0;
+    uint32_t length   = 0;
+
+    while (position < size) {
+        const uint8_t code = frame[position++];
+        if (code == 0 || position + code - 1 > size) {
+            return 0;
+        }
+        for (uint32_t i = 1; i < code; i++) {
+            record[length++] = frame[position++];
+        }
+        // A full run is not followed by a zero, and neither is the end of the record
+        if (code != 0xFF && position < size) {
+            record[length++] = 0;
+        }
+    }
+    return length;
+}
+
+static void process_record(const uint8_t* record, uint32_t size) {
+    uint16_t samples[WAVEFORM_STREAM_FRAME_SCANS * DELTA_CODEC_CHANNELS];
+
+    if (size < BINARY_FRAME_HEADER_SIZE + BINARY_FRAME_CRC_SIZE) {
+        discarded_frames++;
+        return;
+    }
+    const uint32_t payload_size = size - BINARY_FRAME_HEADER_SIZE - BINARY_FRAME_CRC_SIZE;
+    const uint16_t crc = record[size - 2] | record[size - 1] << 8;
+    if (binary_frame_crc16(record, size - BINARY_FRAME_CRC_SIZE) != crc) {
+        discarded_frames++;
+        return;
+    }
+
+    const uint8_t channel   = record[0];
+    const uint32_t scans    = record[1];
+    const uint16_t sequence = record[2] | record[3] << 8;
+    const uint8_t* payload  = &record[BINARY_FRAME_HEADER_SIZE];
+    if ((channel != WAVEFORM_STREAM_KEYFRAME_CHANNEL
+         && channel != WAVEFORM_STREAM_DELTA_CHANNEL)
+        || scans > WAVEFORM_STREAM_FRAME_SCANS) {
+        return;
+    }
+
+    if (is_synchronized && sequence != expected_sequence) {
+        lost_frames += (uint16_t)(sequence - expected_sequence);
+        is_synchronized = false;
+    }
+    expected_sequence = sequence + 1;
+
+    uint32_t position = 0;
+    if (channel == WAVEFORM_STREAM_KEYFRAME_CHANNEL) {
+        position = delta_codec_get_varint(payload, payload_size, &next_scan);
+        if (position == 0) {
+            is_synchronized = false;
+            return;
+        }
+        is_synchronized = true;
+    } else if (!is_synchronized) {
+        return;
+    }
+
+    if (delta_codec_decode(&codec, &payload[position], payload_size - position, scans,
+                           channel == WAVEFORM_STREAM_KEYFRAME_CHANNEL, samples)
+        == 0) {
+        is_synchronized = false;
+        return;
+    }
+    for (uint32_t i = 0; i < scans; i++, next_scan++) {
+        printf("%u,%u,%u\n", next_scan, samples[2 * i], samples[2 * i + 1]);
+    }
+}
@@ -0,0 +1,317 @@
+/**
+ * @file waveform_stream_test.c
+ * @brief Host round trip test of the waveform stream. Synthetic blocks are fed to the
+ * stream as the DMA interrupt does, the frames sent to the USB are decoded as the host
+ * does, and every decoded scan must be equal to the generated one. Scans may only be
+ * lost while the USB is stalled long enough to overflow the ring, and the stream must
+ * resynchronize on the next keyframe. The compression ratio of every signal is printed,
+ * the payload against the 4 bytes of the raw codes of a scan, and checked against a
+ * minimum. Built and run on the host with
+ *
+ * gcc -std=c17 -O2 -Itools/host -IInc tools/waveform_stream_test.c
+ *     Src/application/waveform_stream.c Src/application/delta_codec.c
+ *     Src/application/binary_frame.c Src/application/formatter.c -lm
+ *     -o waveform_stream_test
+ *
+ */
+
+#include "application/acquisition.h"
+#include "application/binary_frame.h"
+#include "application/delta_codec.h"
+#include "application/waveform_stream.h"
+#include "usbd_cdc_if.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define PI 3.14159265358979323846
+
+#define TEST_BLOCKS        400
+#define TEST_SCANS         (TEST_BLOCKS * ACQUISITION_BLOCK_SCANS)
+#define RAW_BYTES_PER_SCAN (DELTA_CODEC_CHANNELS * sizeof(uint16_t))
+
+// Synthetic input of the stream and what is expected from it
+struct stream_case {
+    const char* name;
+    uint32_t sample_rate;
+    double frequency;
+    // Peak of the sines in codes, around the middle of the scale
+    double voltage_amplitude;
+    double current_amplitude;
+    // Peak to peak of the noise added to every sample, in codes
+    uint32_t noise_codes;
+    // Square wave between the codes 0 and 4095 at half the sample rate, the worst case
+    // of the codec
+    bool is_full_scale;
+    // Blocks during which the USB refuses every frame, so the ring overflows
+    uint32_t stall_first_block;
+    uint32_t stall_blocks;
+    // Smallest compression ratio accepted. Every value takes at least one byte, so the
+    // ratio stays below 2, and the worst case is a little below 1 with the scan number
+    // of the keyframes
+    double min_ratio;
+};
+
+/**
+ * @brief Generates the voltage and current codes of every scan of a case
+ *
+ * @param test case to be generated
+ */
+static void generate(const struct stream_case* test);
+
+/**
+ * @brief Streams the scans of a case and checks the decoded scans
+ *
+ * @param test case to be run
+ * @return true if the round trip is exact and the ratio is above the minimum
+ */
+static bool run(const struct stream_case* test);
+
+/**
+ * @brief Decodes a frame with Consistent Overhead Byte Stuffing, without its delimiter
+ *
+ * @param frame encoded frame
+ * @param size size of the frame
+ * @param record where the record is written, size bytes at most
+ * @return uint32_t size of the record, zero when the frame is malformed
+ */
+static uint32_t cobs_decode(const uint8_t* frame, uint32_t size, uint8_t* record);
+
+/**
+ * @brief Checks and decodes a record of the stream, and compares its scans with the
+ * generated ones
+ *
+ * @param record record without COBS
+ * @param size size of the record
+ */
+static void process_record(const uint8_t* record, uint32_t size);
+
+static const struct stream_case cases[] = {
+    {"60 Hz mains", 7680, 60.0, 1800.0, 600.0, 4, false, 0, 0, 1.5},
+    {"50 Hz mains", 7680, 50.0, 1800.0, 600.0, 4, false, 0, 0, 1.5},
+    {"60 Hz at the highest rate", ACQUISITION_HIGHEST_SAMPLE_RATE_HZ, 60.0, 1800.0,
+     600.0, 4, false, 0, 0, 1.9},
+    {"60 Hz with a stalled USB", 7680, 60.0, 1800.0, 600.0, 4, false, 100, 10, 1.5},
+    {"full scale square wave", 7680, 0.0, 0.0, 0.0, 0, true, 0, 0, 0.95},
+};
+
+static uint16_t generated[TEST_SCANS][DELTA_CODEC_CHANNELS];
+static uint32_t sample_rate;
+static bool is_usb_stalled;
+
+// State of the decoder of the host
+static struct delta_codec codec;
+static bool is_synchronized;
+static uint16_t expected_sequence;
+static uint32_t next_scan;
+
+// Results of the running case
+static uint32_t decoded_scans;
+static uint32_t wrong_scans;
+static uint32_t rejected_frames;
+static uint32_t keyframes;
+static uint32_t frames;
+static uint32_t longest_delta_run;
+static uint32_t delta_run;
+static uint64_t payload_bytes;
+static uint64_t frame_bytes;
+
+int main(void) {
+    uint32_t failures = 0;
+
+    for (uint32_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        failures += !run(&cases[i]);
+    }
+
+    printf("%s, %u failed tests\n", failures == 0 ? "PASS" : "FAIL", failures);
+    return failures == 0 ? 0 : 1;
+}
+
+uint32_t acquisition_get_scan_size(void) {
+    return ACQUISITION_NUM_CHANNELS;
+}
+
+uint32_t acquisition_get_sample_rate(void) {
+    return sample_rate;
+}
+
+uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len) {
+    uint8_t record[BINARY_FRAME_MAX_SIZE];
+
+    if (is_usb_stalled) {
+        return USBD_BUSY;
+    }
+    // The text messages of the stream end with a new line, the frames with a delimiter
+    if (Len == 0 || Buf[Len - 1] != 0) {
+        return USBD_OK;
+    }
+    frame_bytes += Len;
+    const uint32_t record_size = cobs_decode(Buf, Len - 1, record);
+    if (record_size == 0) {
+        rejected_frames++;
+    } else {
+        process_record(record, record_size);
+    }
+    return USBD_OK;
+}
+
+static void generate(const struct stream_case* test) {
+    uint32_t seed = 0x12345678;
+
+    for (uint32_t n = 0; n < TEST_SCANS; n++) {
+        if (test->is_full_scale) {
+            generated[n][0] = n % 2 == 0 ? 0 : 4095;
+            generated[n][1] = n % 2 == 0 ? 4095 : 0;
+            continue;
+        }
+        const double angle = 2 * PI * test->frequency * n / test->sample_rate;
+        double noise[DELTA_CODEC_CHANNELS];
+        for (uint32_t channel = 0; channel < DELTA_CODEC_CHANNELS; channel++) {
+            seed           = seed * 1664525 + 1013904223;
+            noise[channel] = (double)(seed >> 16) * test->noise_codes / 65536.0;
+        }
+        generated[n][0] =
+            lround(2048 + test->voltage_amplitude * sin(angle) + noise[0] - 2);
+        generated[n][1] =
+            lround(2048 + test->current_amplitude * sin(angle - PI / 6) + noise[1] - 2);
+    }
+}
+
+static bool run(const struct stream_case* test) {
+    uint16_t block[ACQUISITION_BLOCK_SCANS][ACQUISITION_NUM_CHANNELS];
+
+    generate(test);
+    sample_rate       = test->sample_rate;
+    is_usb_stalled    = false;
+    is_synchronized   = false;
+    decoded_scans     = 0;
+    wrong_scans       = 0;
+    rejected_frames   = 0;
+    keyframes         = 0;
+    frames            = 0;
+    longest_delta_run = 0;
+    delta_run         = 0;
+    payload_bytes     = 0;
+    frame_bytes       = 0;
+    waveform_stream_update_status(1);
+    waveform_stream_handler();
+
+    for (uint32_t b = 0; b < TEST_BLOCKS; b++) {
+        for (uint32_t i = 0; i < ACQUISITION_BLOCK_SCANS; i++) {
+            const uint32_t n                       = b * ACQUISITION_BLOCK_SCANS + i;
+            block[i][ACQUISITION_RANK_VOLTAGE]     = generated[n][0];
+            block[i][ACQUISITION_RANK_CURRENT]     = generated[n][1];
+            block[i][ACQUISITION_RANK_LUX]         = 0;
+            block[i][ACQUISITION_RANK_TEMPERATURE] = 0;
+        }
+        waveform_stream_process_block(&block[0][0], ACQUISITION_BLOCK_SCANS);
+        is_usb_stalled = b >= test->stall_first_block
+                         && b < test->stall_first_block + test->stall_blocks;
+        waveform_stream_handler();
+    }
+    is_usb_stalled = false;
+    waveform_stream_handler();
+    waveform_stream_update_status(0);
+    waveform_stream_handler();
+
+    const uint32_t lost_scans = TEST_SCANS - decoded_scans;
+    const double ratio = (double)decoded_scans * RAW_BYTES_PER_SCAN / payload_bytes;
+    // Scans are lost only when, and always when, the stall overflows the ring
+    const bool is_passed = wrong_scans == 0 && rejected_frames == 0
+                           && (lost_scans == 0) == (test->stall_blocks == 0)
+                           && longest_delta_run < WAVEFORM_STREAM_KEYFRAME_INTERVAL
+                           && ratio >= test->min_ratio;
+    printf("%s: %s, %u scans decoded, %u lost, %u wrong, %u of %u frames are keyframes\n",
+           is_passed ? "ok" : "FAIL", test->name, decoded_scans, lost_scans, wrong_scans,
+           keyframes, frames);
+    printf("    payload %.2f bytes per scan, ratio %.2f, with the framing %.2f bytes per "
+           "scan\n",
+           (double)payload_bytes / decoded_scans, ratio,
+           (double)frame_bytes / decoded_scans);
+    return is_passed;
+}
+
+static uint32_t cobs_decode(const uint8_t* frame, uint32_t size, uint8_t* record) {
+    uint32_t position = 0;
+    uint32_t length   = 0;
+
+    while (position < size) {
+        const uint8_t code = frame[position++];
+        if (code == 0 || position + code - 1 > size) {
+            return 0;
+        }
+        for (uint32_t i = 1; i < code; i++) {
+            record[length++] = frame[position++];
+        }
+        // A full run is not followed by a zero, and neither is the end of the record
+        if (code != 0xFF && position < size) {
+            record[length++] = 0;
+        }
+    }
+    return length;
+}
+
+static void process_record(const uint8_t* record, uint32_t size) {
+    uint16_t samples[WAVEFORM_STREAM_FRAME_SCANS][DELTA_CODEC_CHANNELS];
+
+    if (size < BINARY_FRAME_HEADER_SIZE + BINARY_FRAME_CRC_SIZE) {
+        rejected_frames++;
+        return;
+    }
+    const uint32_t payload_size = size - BINARY_FRAME_HEADER_SIZE - BINARY_FRAME_CRC_SIZE;
+    const uint16_t crc          = record[size - 2] | record[size - 1] << 8;
+    const uint8_t channel       = record[0];
+    const uint32_t scans        = record[1];
+    const uint16_t sequence     = record[2] | record[3] << 8;
+    const uint8_t* payload      = &record[BINARY_FRAME_HEADER_SIZE];
+    if (binary_frame_crc16(record, size - BINARY_FRAME_CRC_SIZE) != crc
+        || (channel != WAVEFORM_STREAM_KEYFRAME_CHANNEL
+            && channel != WAVEFORM_STREAM_DELTA_CHANNEL)
+        || scans != WAVEFORM_STREAM_FRAME_SCANS) {
+        rejected_frames++;
+        return;
+    }
+
+    // Frames are refused by the stalled USB, never lost once accepted
+    if (is_synchronized && sequence != expected_sequence) {
+        rejected_frames++;
+        is_synchronized = false;
+    }
+    expected_sequence = sequence + 1;
+    frames++;
+
+    uint32_t position = 0;
+    if (channel == WAVEFORM_STREAM_KEYFRAME_CHANNEL) {
+        position = delta_codec_get_varint(payload, payload_size, &next_scan);
+        if (position == 0) {
+            rejected_frames++;
+            is_synchronized = false;
+            return;
+        }
+        is_synchronized = true;
+        keyframes++;
+        delta_run = 0;
+    } else if (!is_synchronized) {
+        rejected_frames++;
+        return;
+    } else if (++delta_run > longest_delta_run) {
+        longest_delta_run = delta_run;
+    }
+
+    const uint32_t read =
+        delta_codec_decode(&codec, &payload[position], payload_size - position, scans,
+                           channel == WAVEFORM_STREAM_KEYFRAME_CHANNEL, &samples[0][0]);
+    if (read == 0 || position + read != payload_size || next_scan + scans > TEST_SCANS) {
+        rejected_frames++;
+        is_synchronized = false;
+        return;
+    }
+    payload_bytes += payload_size;
+    for (uint32_t i = 0; i < scans; i++, next_scan++) {
+        decoded_scans++;
+        wrong_scans += memcmp(samples[i], generated[next_scan], sizeof(samples[i])) != 0;
+    }
+}